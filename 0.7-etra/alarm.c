@@ -0,0 +1,257 @@
+/* SUSI Library - Sensor Alarms
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ * Threshold and rate-of-change alarms, evaluated on every sensor
+ * reading as it is recorded. Raise and clear transitions are queued
+ * and signalled on an eventfd so consumers can sleep in poll()
+ * instead of reading sensors themselves.
+ */
+
+#include "susi.h"
+#include <pthread.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+#define ALARM_QUEUE		64
+
+/* Per-sensor alarm state */
+struct alarm_sensor {
+	SusiAlarmConfig cfg;
+	u32 active;
+	flt prev;
+	u64 prev_stamp;
+};
+
+/* Globals */
+
+extern __thread int susi_err;
+
+static struct alarm_sensor alarms [SUSI_SENSOR_MAX];
+static SusiAlarmEvent queue [ALARM_QUEUE];
+static u32 q_head = 0, q_used = 0, q_lost = 0;
+static int alarm_fd = -1;
+static pthread_mutex_t alarm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* Queue a transition and wake waiters, alarm_lock held - (Internal) */
+static void __alarm_post(u32 sensor, u32 alarm, u32 active, flt value,
+			 u64 stamp)
+{
+	SusiAlarmEvent *ev;
+	u64 one = 1;
+
+	/* Drop the oldest event when full */
+	if (q_used == ALARM_QUEUE) {
+		q_head = (q_head + 1) % ALARM_QUEUE;
+		q_used--;
+		q_lost++;
+	}
+
+	ev = &queue [(q_head + q_used++) % ALARM_QUEUE];
+	ev->sensor = sensor;
+	ev->alarm = alarm;
+	ev->active = active;
+	ev->value = value;
+	ev->stamp = stamp;
+
+	if (alarm_fd >= 0 && write(alarm_fd, &one, sizeof(one)) < 0)
+		debug("%s: eventfd write failed\n", __FUNC__);
+}
+
+/* Update one alarm condition, alarm_lock held - (Internal) */
+static void __alarm_set(u32 sensor, u32 alarm, int raise, int clear,
+			flt value, u64 stamp)
+{
+	struct alarm_sensor *a = &alarms [sensor];
+
+	if (!(a->active & alarm) && raise) {
+		a->active |= alarm;
+		__alarm_post(sensor, alarm, 1, value, stamp);
+	} else if ((a->active & alarm) && clear) {
+		a->active &= ~alarm;
+		__alarm_post(sensor, alarm, 0, value, stamp);
+	}
+}
+
+/* Evaluate alarms for a new reading - (Internal) */
+void __alarm_eval(u32 id, flt value, u64 stamp)
+{
+	struct alarm_sensor *a;
+	flt rate;
+
+	if (id >= SUSI_SENSOR_MAX)
+		return;
+
+	a = &alarms [id];
+
+	/* Unlocked peek; configuration races only delay one evaluation */
+	if (!a->cfg.flags && !a->active)
+		return;
+
+	pthread_mutex_lock(&alarm_lock);
+
+	if (a->cfg.flags & SUSI_ALARM_HIGH)
+		__alarm_set(id, SUSI_ALARM_HIGH, value > a->cfg.high,
+			    value < a->cfg.high - a->cfg.hyst, value, stamp);
+
+	if (a->cfg.flags & SUSI_ALARM_LOW)
+		__alarm_set(id, SUSI_ALARM_LOW, value < a->cfg.low,
+			    value > a->cfg.low + a->cfg.hyst, value, stamp);
+
+	if ((a->cfg.flags & SUSI_ALARM_RATE) && a->prev_stamp && 
+	    stamp > a->prev_stamp) {
+		rate = (value - a->prev) * 1e9f / (flt)(stamp - a->prev_stamp);
+		if (rate < 0)
+			rate = -rate;
+
+		__alarm_set(id, SUSI_ALARM_RATE, rate > a->cfg.rate,
+			    rate <= a->cfg.rate, value, stamp);
+	}
+
+	a->prev = value;
+	a->prev_stamp = stamp;
+
+	pthread_mutex_unlock(&alarm_lock);
+}
+
+/* Distance from value to the nearest high/low limit, -1 if none - (Internal) */
+flt __alarm_margin(u32 id, flt value)
+{
+	SusiAlarmConfig cfg;
+	flt m = -1, d;
+
+	if (id >= SUSI_SENSOR_MAX)
+		return -1;
+
+	pthread_mutex_lock(&alarm_lock);
+	cfg = alarms [id].cfg;
+	pthread_mutex_unlock(&alarm_lock);
+
+	if (cfg.flags & SUSI_ALARM_HIGH) {
+		d = cfg.high - value;
+		m = d < 0 ? 0 : d;
+	}
+
+	if (cfg.flags & SUSI_ALARM_LOW) {
+		d = value - cfg.low;
+		if (d < 0)
+			d = 0;
+		if (m < 0 || d < m)
+			m = d;
+	}
+
+	return m;
+}
+
+/* -------------------------- External API --------------------------------- */
+
+/* Set alarm limits for a sensor, flags 0 disables its alarms */
+s8 SusiAlarmSet(u32 sensor, const SusiAlarmConfig *cfg)
+{
+	struct alarm_sensor *a;
+	u32 cleared, bit;
+
+	if (sensor >= SUSI_SENSOR_MAX || !cfg || cfg->hyst < 0 || 
+	    ((cfg->flags & SUSI_ALARM_RATE) && cfg->rate <= 0) ||
+	    ((cfg->flags & SUSI_ALARM_HIGH) && (cfg->flags & SUSI_ALARM_LOW) &&
+	     cfg->low >= cfg->high)) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	a = &alarms [sensor];
+
+	pthread_mutex_lock(&alarm_lock);
+
+	/* Alarms no longer configured clear now */
+	cleared = a->active & ~cfg->flags;
+
+	for (bit = SUSI_ALARM_HIGH; bit <= SUSI_ALARM_RATE; bit <<= 1)
+		if (cleared & bit)
+			__alarm_set(sensor, bit, 0, 1, a->prev, a->prev_stamp);
+
+	a->cfg = *cfg;
+
+	pthread_mutex_unlock(&alarm_lock);
+
+	return 1;
+}
+
+/* Active alarms of a sensor, SUSI_ALARM_* mask */
+s8 SusiAlarmQuery(u32 sensor, u32 *active)
+{
+	if (sensor >= SUSI_SENSOR_MAX || !active) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&alarm_lock);
+	*active = alarms [sensor].active;
+	pthread_mutex_unlock(&alarm_lock);
+
+	return 1;
+}
+
+/* Pollable descriptor, readable while events are queued */
+s8 SusiAlarmGetFd(int *fd)
+{
+	if (!fd) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&alarm_lock);
+
+	if (alarm_fd < 0 && 
+	    (alarm_fd = eventfd(q_used, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		susi_err = -errno;
+		pthread_mutex_unlock(&alarm_lock);
+		return 0;
+	}
+
+	*fd = alarm_fd;
+
+	pthread_mutex_unlock(&alarm_lock);
+
+	return 1;
+}
+
+/* Dequeue up to max transitions, oldest first; lost counts overflow */
+s8 SusiAlarmRead(SusiAlarmEvent *buf, u32 max, u32 *count, u32 *lost)
+{
+	u64 drain;
+	u32 n = 0;
+
+	if (!buf || !count) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&alarm_lock);
+
+	for (; n < max && q_used; n++, q_used--) {
+		buf [n] = queue [q_head];
+		q_head = (q_head + 1) % ALARM_QUEUE;
+	}
+
+	if (lost) {
+		*lost = q_lost;
+		q_lost = 0;
+	}
+
+	/* Re-arm the eventfd for whatever is still queued */
+	if (alarm_fd >= 0 && read(alarm_fd, &drain, sizeof(drain)) >= 0 && 
+	    q_used) {
+		drain = q_used;
+		if (write(alarm_fd, &drain, sizeof(drain)) < 0)
+			debug("%s: eventfd write failed\n", __FUNC__);
+	}
+
+	pthread_mutex_unlock(&alarm_lock);
+
+	*count = n;
+	return 1;
+}
@@ -0,0 +1,273 @@
+/* SUSI Library - Value Cache and Counters
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ * Last values read from or written to the hardware, and library
+ * performance counters. Each entry keeps two copies behind a sequence
+ * counter: readers take the copy no writer is touching, so they never
+ * block, spin on a writer or enter the kernel, even when the writer
+ * was preempted by the reader. Writers are serialized by a priority
+ * inheriting mutex.
+ */
+
+#include "susi.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+/* Sensor reading */
+struct sensor_val {
+	flt value;
+	u64 stamp;
+};
+
+struct cache_sensor {
+	u32 seq;
+	struct sensor_val v [2];
+};
+
+/* GPIO levels */
+struct io_val {
+	u32 known;		/* Pins with a cached level */
+	u32 status;
+	u64 stamp;
+};
+
+struct cache_io {
+	u32 seq;
+	struct io_val v [2];
+};
+
+/* Watchdog state */
+struct wd_val {
+	u32 armed;
+	u32 timeout;		/* ms */
+	u64 trigger;		/* Stamp of last trigger */
+};
+
+struct cache_wd {
+	u32 seq;
+	struct wd_val v [2];
+};
+
+/* Globals */
+
+extern __thread int susi_err;
+
+extern void __history_add(u32 id, flt value, u64 stamp);
+extern void __alarm_eval(u32 id, flt value, u64 stamp);
+
+static struct cache_sensor sensors [SUSI_SENSOR_MAX];
+static struct cache_io io;
+static struct cache_wd wd;
+static u64 stats [SUSI_STAT_MAX];
+
+static pthread_mutex_t cache_lock;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* Monotonic time in ns - (Internal) */
+u64 __now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Writer lock, priority inheriting - (Internal) */
+static void __cache_init(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&cache_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void __cache_lock(void)
+{
+	pthread_once(&cache_once, __cache_init);
+	pthread_mutex_lock(&cache_lock);
+}
+
+static void __cache_unlock(void)
+{
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/* Publish val to both copies v [0], v [1], cache_lock held
+ * - (Internal) */
+static void __latch_write(u32 *seq, void *v, const void *val, size_t size)
+{
+	u32 s = *seq;
+
+	/* Readers use copy 1 while copy 0 changes, then copy 0 */
+	__atomic_store_n(seq, s + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(v, val, size);
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(seq, s + 2, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy((u8 *)v + size, val, size);
+}
+
+/* Read the stable copy; retries only if a writer moved on meanwhile
+ * - (Internal) */
+static void __latch_read(const u32 *seq, const void *v, void *val, size_t size)
+{
+	u32 s;
+
+	do {
+		s = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		memcpy(val, (const u8 *)v + (s & 1) * size, size);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(seq, __ATOMIC_RELAXED) != s);
+}
+
+/* Record a sensor reading - (Internal) */
+void __cache_sensor(u32 id, flt value)
+{
+	struct sensor_val v;
+
+	if (id >= SUSI_SENSOR_MAX)
+		return;
+
+	v.value = value;
+	v.stamp = __now_ns();
+
+	__cache_lock();
+	__latch_write(&sensors [id].seq, sensors [id].v, &v, sizeof(v));
+	__cache_unlock();
+
+	__history_add(id, v.value, v.stamp);
+	__alarm_eval(id, v.value, v.stamp);
+}
+
+/* Record user GPIO levels for the pins in mask - (Internal) */
+void __cache_io(u32 mask, u32 status)
+{
+	struct io_val v;
+
+	__cache_lock();
+	v = io.v [0];
+	v.known |= mask;
+	v.status = (v.status & ~mask) | (status & mask);
+	v.stamp = __now_ns();
+	__latch_write(&io.seq, io.v, &v, sizeof(v));
+	__cache_unlock();
+}
+
+/* Record watchdog configuration - (Internal) */
+void __cache_wd(u32 armed, u32 timeout)
+{
+	struct wd_val v;
+
+	__cache_lock();
+	v = wd.v [0];
+	v.armed = armed;
+	if (armed) {
+		v.timeout = timeout;
+		v.trigger = __now_ns();
+	}
+	__latch_write(&wd.seq, wd.v, &v, sizeof(v));
+	__cache_unlock();
+}
+
+/* Record watchdog trigger - (Internal) */
+void __cache_wd_trigger(void)
+{
+	struct wd_val v;
+
+	__cache_lock();
+	v = wd.v [0];
+	v.trigger = __now_ns();
+	__latch_write(&wd.seq, wd.v, &v, sizeof(v));
+	__cache_unlock();
+}
+
+/* Bump a counter - (Internal) */
+void __stat_add(u32 id, u64 n)
+{
+	__atomic_fetch_add(&stats [id], n, __ATOMIC_RELAXED);
+}
+
+/* -------------------------- External API --------------------------------- */
+
+/* Last sensor reading, no hardware access */
+s8 SusiHWMGetCached(u32 sensor, flt *retval, u64 *stamp)
+{
+	struct sensor_val c;
+
+	if (sensor >= SUSI_SENSOR_MAX || !retval) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	__latch_read(&sensors [sensor].seq, sensors [sensor].v, &c, sizeof(c));
+
+	if (!c.stamp) {
+		susi_err = -ENODATA;
+		return 0;
+	}
+
+	*retval = c.value;
+	if (stamp)
+		*stamp = c.stamp;
+
+	return 1;
+}
+
+/* Last known user GPIO levels, no hardware access */
+s8 SusiIOGetCached(u32 *knownmask, u32 *statusmask)
+{
+	struct io_val c;
+
+	if (!knownmask || !statusmask) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	__latch_read(&io.seq, io.v, &c, sizeof(c));
+
+	*knownmask = c.known;
+	*statusmask = c.status;
+
+	return 1;
+}
+
+/* Watchdog state as last configured, no hardware access */
+s8 SusiWDGetCached(u32 *armed, u32 *timeout, u64 *trigger)
+{
+	struct wd_val c;
+
+	if (!armed || !timeout) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	__latch_read(&wd.seq, wd.v, &c, sizeof(c));
+
+	*armed = c.armed;
+	*timeout = c.timeout;
+	if (trigger)
+		*trigger = c.trigger;
+
+	return 1;
+}
+
+/* Library performance counter */
+s8 SusiGetStat(u32 id, u64 *value)
+{
+	if (id >= SUSI_STAT_MAX || !value) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	*value = __atomic_load_n(&stats [id], __ATOMIC_RELAXED);
+	return 1;
+}
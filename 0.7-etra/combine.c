@@ -0,0 +1,314 @@
+/* SUSI Library - SMBus Write Combining
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ * When enabled, SusiSMBusWriteByte only queues the write. Writes to
+ * a queued (address, register) replace the value in place, so just
+ * the last value reaches the bus. SusiSMBusReadByte of a queued
+ * register is answered from the queue. The queue goes out as one
+ * transfer on SusiSMBusFlush, when it fills, once the oldest write is
+ * window us old, and before any other SMBus access of this process.
+ * Registers are written in the order they were first queued. The last
+ * SusiUnInit writes out the queue, turns combining off and joins the
+ * flusher.
+ */
+
+#include "susi.h"
+#include <pthread.h>
+#include <time.h>
+
+#define WC_MAX			32
+
+/* Queued write */
+struct wc_entry {
+	u8 address;
+	u8 reg;
+	u8 value;
+};
+
+/* Globals */
+
+extern __thread int susi_err;
+
+extern u64 __now_ns(void);
+extern s32 __thread_create(pthread_t *tid, void *(*fn)(void *), void *arg);
+extern s32 __smbus_run(SusiSMBusXfer *ops, u32 count);
+
+static struct wc_entry queue [WC_MAX];
+static u32 wc_count = 0;
+static u64 wc_oldest = 0;		/* Time of the first queued write */
+static s32 wc_err = 0;			/* Last background flush error */
+static int wc_on = 0;
+static u32 wc_window = 0;		/* us, 0 = explicit flush only */
+static pthread_mutex_t wc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t wc_ctl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wc_cond;
+static pthread_once_t wc_once = PTHREAD_ONCE_INIT;
+static pthread_t wc_tid;
+static int wc_running = 0;		/* Started / joined under wc_ctl_lock */
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* Condition variable on the monotonic clock - (Internal) */
+static void __wc_init(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&wc_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/* Write out the queue, wc_lock held - (Internal) */
+static s32 __wc_drain(void)
+{
+	SusiSMBusXfer ops [WC_MAX];
+	u32 i = 0, n = wc_count;
+
+	if (!n)
+		return 0;
+
+	for (; i < n; i++) {
+		ops [i].address = queue [i].address;
+		ops [i].flags = SUSI_XFER_WRITE;
+		ops [i].cmd = queue [i].reg;
+		ops [i].len = 1;
+		ops [i].data [0] = queue [i].value;
+	}
+
+	/* Dropped either way; a failed write is not retried */
+	__atomic_store_n(&wc_count, 0, __ATOMIC_RELEASE);
+
+	return __smbus_run(ops, n);
+}
+
+/* Flush pending writes ahead of another SMBus access - (Internal) */
+s32 __wc_flush(void)
+{
+	s32 ret;
+
+	if (!__atomic_load_n(&wc_count, __ATOMIC_ACQUIRE))
+		return 0;
+
+	pthread_mutex_lock(&wc_lock);
+	ret = __wc_drain();
+	pthread_mutex_unlock(&wc_lock);
+
+	return ret;
+}
+
+/* Queue a byte write; 1 if queued, 0 if combining is off - (Internal) */
+s32 __wc_write(u8 address, u8 reg, u8 value)
+{
+	u32 i = 0;
+	s32 ret = 1;
+
+	if (!__atomic_load_n(&wc_on, __ATOMIC_ACQUIRE))
+		return 0;
+
+	pthread_mutex_lock(&wc_lock);
+
+	/* Disabled meanwhile; write through after draining */
+	if (!wc_on) {
+		ret = __wc_drain();
+		pthread_mutex_unlock(&wc_lock);
+		return ret;
+	}
+
+	for (; i < wc_count; i++)
+		if (queue [i].address == address && queue [i].reg == reg)
+			break;
+
+	if (i == WC_MAX) {
+		/* Full; make room */
+		if ((ret = __wc_drain()) < 0) {
+			pthread_mutex_unlock(&wc_lock);
+			return ret;
+		}
+
+		i = 0;
+		ret = 1;
+	}
+
+	queue [i].address = address;
+	queue [i].reg = reg;
+	queue [i].value = value;
+
+	if (i == wc_count) {
+		if (!wc_count) {
+			wc_oldest = __now_ns();
+			pthread_cond_signal(&wc_cond);
+		}
+
+		__atomic_store_n(&wc_count, wc_count + 1, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&wc_lock);
+
+	return ret;
+}
+
+/* Serve a read from a queued write; 1 if served - (Internal) */
+s32 __wc_read(u8 address, u8 reg, u8 *value)
+{
+	u32 i = 0;
+	s32 ret = 0;
+
+	if (!__atomic_load_n(&wc_count, __ATOMIC_ACQUIRE))
+		return 0;
+
+	pthread_mutex_lock(&wc_lock);
+
+	for (; i < wc_count; i++)
+		if (queue [i].address == address && queue [i].reg == reg) {
+			*value = queue [i].value;
+			ret = 1;
+			break;
+		}
+
+	pthread_mutex_unlock(&wc_lock);
+
+	return ret;
+}
+
+/* Window flusher thread - (Internal) */
+static void *__wc_thread(void *arg)
+{
+	struct timespec ts;
+	u64 due;
+	s32 ret;
+
+	pthread_mutex_lock(&wc_lock);
+
+	while (wc_running) {
+		if (!wc_count) {
+			pthread_cond_wait(&wc_cond, &wc_lock);
+			continue;
+		}
+
+		due = wc_oldest + wc_window * 1000ULL;
+
+		if (due > __now_ns()) {
+			ts.tv_sec = due / 1000000000ULL;
+			ts.tv_nsec = due % 1000000000ULL;
+			pthread_cond_timedwait(&wc_cond, &wc_lock, &ts);
+			continue;
+		}
+
+		if ((ret = __wc_drain()) < 0)
+			wc_err = ret;
+	}
+
+	pthread_mutex_unlock(&wc_lock);
+
+	return NULL;
+}
+
+/* Write out the queue, turn combining off and join the flusher; called
+ * by the last SusiUnInit - (Internal) */
+s32 __wc_stop(void)
+{
+	s32 ret;
+	int stop;
+
+	pthread_mutex_lock(&wc_ctl_lock);
+	pthread_mutex_lock(&wc_lock);
+
+	ret = __wc_drain();
+	__atomic_store_n(&wc_on, 0, __ATOMIC_RELEASE);
+
+	if ((stop = wc_running)) {
+		wc_running = 0;
+		pthread_cond_signal(&wc_cond);
+	}
+
+	wc_err = 0;
+
+	pthread_mutex_unlock(&wc_lock);
+
+	if (stop)
+		pthread_join(wc_tid, NULL);
+
+	pthread_mutex_unlock(&wc_ctl_lock);
+
+	return ret;
+}
+
+/* -------------------------- External API --------------------------------- */
+
+/* Turn write combining on or off; with a window (us) writes are also
+ * flushed once the oldest is that old */
+s8 SusiSMBusCombine(u8 enable, u32 window)
+{
+	s32 ret = 0;
+	int stop;
+
+	if (enable != 0 && enable != 1) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	pthread_once(&wc_once, __wc_init);
+
+	/* One caller at a time starts or joins the flusher */
+	pthread_mutex_lock(&wc_ctl_lock);
+	pthread_mutex_lock(&wc_lock);
+
+	if (!enable)
+		ret = __wc_drain();
+
+	__atomic_store_n(&wc_on, enable, __ATOMIC_RELEASE);
+	wc_window = window;
+
+	/* Flusher runs while a window is set */
+	stop = wc_running && (!enable || !window);
+
+	if (enable && window && !wc_running) {
+		wc_running = 1;
+
+		if ((ret = __thread_create(&wc_tid, __wc_thread, NULL)) < 0)
+			wc_running = 0;
+	} else if (stop)
+		wc_running = 0;
+
+	pthread_cond_signal(&wc_cond);
+	pthread_mutex_unlock(&wc_lock);
+
+	if (stop)
+		pthread_join(wc_tid, NULL);
+
+	pthread_mutex_unlock(&wc_ctl_lock);
+
+	if (ret < 0) {
+		susi_err = ret;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Write out queued writes now; also reports a failed window flush */
+s8 SusiSMBusFlush(void)
+{
+	s32 ret;
+
+	pthread_mutex_lock(&wc_lock);
+
+	ret = __wc_drain();
+
+	if (ret >= 0 && wc_err < 0)
+		ret = wc_err;
+
+	wc_err = 0;
+
+	pthread_mutex_unlock(&wc_lock);
+
+	if (ret < 0) {
+		susi_err = ret;
+		return 0;
+	}
+
+	return 1;
+}
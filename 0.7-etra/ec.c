@@ -0,0 +1,384 @@
+/* SUSI Library - EC Mailbox
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ * Command/data exchanges with the EC through the PMC2 ports. Each
+ * exchange holds the cross-process EC lock, so transactions from
+ * different processes never interleave. The mailbox is driven by
+ * polling the IBF / OBF status bits, bounded by the caller's deadline.
+ *
+ * Polling spins, then yields, then sleeps. The phase limits are fixed
+ * defaults until SusiECCalibrate times a series of side-effect free
+ * reads from command to output-ready; no transaction waits for it.
+ *
+ * When the /dev/bsp helper has the EC ioctls, a sequence of exchanges
+ * is handed to it in one call and the helper does the waiting; the
+ * port I/O path above is the fallback.
+ */
+
+#include "susi.h"
+#include "susi_bsp.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/io.h>
+
+#define EC_PMC2_CMD			0x6C	/* Command / status */
+#define EC_PMC2_DAT			0x68
+
+#define EC_STS_OBF			0x01	/* Output buffer full */
+#define EC_STS_IBF			0x02	/* Input buffer full */
+
+#define EC_TIMEOUT			1000000000ULL	/* Default, ns */
+
+/* Wait phases until calibrated */
+#define EC_SPIN				50000		/* ns */
+#define EC_YIELD			200000		/* ns */
+#define EC_SLEEP_US			100
+
+/* Calibration */
+#define EC_CAL_CMD			0xD9		/* TSYS read */
+#define EC_CAL_SAMPLES			16
+#define EC_CAL_SPIN_MAX			200000		/* ns */
+#define EC_CAL_YIELD_MAX		2000000		/* ns */
+#define EC_CAL_SLEEP_MIN		20		/* us */
+
+/* Globals */
+
+extern __thread int susi_err;
+extern int kernel_fd;
+extern int bsp_io;
+
+extern s32 __acquire_pio(void);
+extern s32 __lock_ec(u64 deadline);
+extern void __unlock_ec(void);
+extern u64 __now_ns(void);
+extern u64 __deadline(u64 fallback);
+extern void __stat_add(u32 id, u64 n);
+
+static SusiECCalibration ec_cal = {
+	.spin = EC_SPIN,
+	.yield = EC_YIELD,
+	.sleep = EC_SLEEP_US,
+};
+static pthread_mutex_t cal_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* Account finished transactions - (Internal) */
+static void __ec_account(u64 start, u32 count, s32 ret)
+{
+	__stat_add(SUSI_STAT_EC_NS, __now_ns() - start);
+	__stat_add(SUSI_STAT_EC_XFERS, count);
+
+	if (ret < 0)
+		__stat_add(SUSI_STAT_EC_ERRORS, 1);
+}
+
+/* Poll status until (status & mask) == want or deadline - (Internal) */
+static s32 __ec_wait(u8 mask, u8 want, u64 deadline)
+{
+	u64 start = __now_ns(), now;
+	u32 spin = __atomic_load_n(&ec_cal.spin, __ATOMIC_RELAXED);
+	u32 yield = __atomic_load_n(&ec_cal.yield, __ATOMIC_RELAXED);
+
+	while ((inb(EC_PMC2_CMD) & mask) != want) {
+		now = __now_ns();
+
+		if (now >= deadline)
+			return -ETIMEDOUT;
+
+		if (now - start < spin)
+			continue;
+		else if (now - start < yield)
+			sched_yield();
+		else
+			usleep(__atomic_load_n(&ec_cal.sleep, __ATOMIC_RELAXED));
+	}
+
+	return 0;
+}
+
+/* Time one probe read, spinning throughout - (Internal) */
+static s32 __ec_probe(u32 *ns)
+{
+	u64 deadline = __now_ns() + EC_TIMEOUT, start;
+	s32 ret;
+
+	if ((ret = __lock_ec(deadline)) < 0)
+		return ret;
+
+	if (inb(EC_PMC2_CMD) & EC_STS_OBF)
+		inb(EC_PMC2_DAT);
+
+	while (inb(EC_PMC2_CMD) & EC_STS_IBF)
+		if (__now_ns() >= deadline) {
+			__unlock_ec();
+			return -ETIMEDOUT;
+		}
+
+	start = __now_ns();
+	outb(EC_CAL_CMD, EC_PMC2_CMD);
+
+	while (!(inb(EC_PMC2_CMD) & EC_STS_OBF))
+		if (__now_ns() >= deadline) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+
+	*ns = __now_ns() - start;
+
+	if (ret == 0)
+		inb(EC_PMC2_DAT);
+
+	__unlock_ec();
+
+	return ret;
+}
+
+static int __cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Measure EC latency and set the wait phases - (Internal) */
+static s32 __ec_calibrate(void)
+{
+	SusiECCalibration cal;
+	u32 lat [EC_CAL_SAMPLES];
+	u32 i = 0;
+	s32 ret;
+
+	for (; i < EC_CAL_SAMPLES; i++)
+		if ((ret = __ec_probe(&lat [i])) < 0)
+			return ret;
+
+	qsort(lat, EC_CAL_SAMPLES, sizeof(lat [0]), __cmp_u32);
+
+	cal.samples = EC_CAL_SAMPLES;
+	cal.min = lat [0];
+	cal.median = lat [EC_CAL_SAMPLES / 2];
+	cal.p90 = lat [EC_CAL_SAMPLES * 9 / 10];
+	cal.max = lat [EC_CAL_SAMPLES - 1];
+
+	/* Spin through the usual case, yield through the tail, sleep in
+	 * small steps beyond that */
+	cal.spin = cal.p90 + cal.p90 / 4;
+	if (cal.spin > EC_CAL_SPIN_MAX)
+		cal.spin = EC_CAL_SPIN_MAX;
+
+	cal.yield = 2 * cal.max;
+	if (cal.yield > EC_CAL_YIELD_MAX)
+		cal.yield = EC_CAL_YIELD_MAX;
+	if (cal.yield < cal.spin)
+		cal.yield = cal.spin;
+
+	cal.sleep = cal.median / 2000;
+	if (cal.sleep < EC_CAL_SLEEP_MIN)
+		cal.sleep = EC_CAL_SLEEP_MIN;
+
+	debug("%s: min %u median %u p90 %u max %u ns\n", __FUNC__, 
+	      cal.min, cal.median, cal.p90, cal.max);
+
+	pthread_mutex_lock(&cal_lock);
+	__atomic_store_n(&ec_cal.spin, cal.spin, __ATOMIC_RELAXED);
+	__atomic_store_n(&ec_cal.yield, cal.yield, __ATOMIC_RELAXED);
+	__atomic_store_n(&ec_cal.sleep, cal.sleep, __ATOMIC_RELAXED);
+	ec_cal.samples = cal.samples;
+	ec_cal.min = cal.min;
+	ec_cal.median = cal.median;
+	ec_cal.p90 = cal.p90;
+	ec_cal.max = cal.max;
+	pthread_mutex_unlock(&cal_lock);
+
+	return 0;
+}
+
+/* One mailbox exchange through the ports, EC lock held - (Internal) */
+static s32 __ec_op_pio(struct bsp_ec_op *op, u64 deadline)
+{
+	s32 ret;
+
+	/* Drop a byte left behind by a transaction that timed out */
+	if (inb(EC_PMC2_CMD) & EC_STS_OBF)
+		inb(EC_PMC2_DAT);
+
+	if ((ret = __ec_wait(EC_STS_IBF, 0, deadline)) < 0)
+		return ret;
+
+	outb(op->cmd, EC_PMC2_CMD);
+
+	if (op->flags & BSP_EC_DATA) {
+		if ((ret = __ec_wait(EC_STS_IBF, 0, deadline)) < 0)
+			return ret;
+
+		outb(op->data, EC_PMC2_DAT);
+	}
+
+	if (!(op->flags & BSP_EC_READ))
+		/* Wait for the EC to take the last byte */
+		return __ec_wait(EC_STS_IBF, 0, deadline);
+
+	if ((ret = __ec_wait(EC_STS_OBF, EC_STS_OBF, deadline)) < 0)
+		return ret;
+
+	op->in = inb(EC_PMC2_DAT);
+	debug("%s: Cmd 0x%x: %d\n", __FUNC__, op->cmd, op->in);
+
+	return 0;
+}
+
+/* Mailbox exchanges in one kernel helper call, EC lock held
+ * - (Internal) */
+static s32 __ec_ops_bsp(struct bsp_ec_op *ops, u32 count, u64 deadline)
+{
+	struct bsp_ec_xfer x;
+	u64 now = __now_ns();
+
+	if (now >= deadline)
+		return -ETIMEDOUT;
+
+	memset(&x, 0, sizeof(x));
+	x.count = count;
+	x.timeout = (deadline - now + 999) / 1000;
+	memcpy(x.ops, ops, count * sizeof(ops [0]));
+
+	if (ioctl(kernel_fd, BSP_IOC_EC_XFER, &x) < 0)
+		return -errno;
+
+	memcpy(ops, x.ops, count * sizeof(ops [0]));
+
+	return 0;
+}
+
+/* Run up to BSP_EC_OPS_MAX exchanges back to back under one EC lock
+ * hold - (Internal) */
+static s32 __ec_ops(struct bsp_ec_op *ops, u32 count)
+{
+	u64 start, deadline;
+	u32 i = 0;
+	s32 ret = 0;
+
+	deadline = __deadline(EC_TIMEOUT);
+
+	if ((ret = __lock_ec(deadline)) < 0)
+		return ret;
+
+	start = __now_ns();
+
+	if (bsp_io)
+		ret = __ec_ops_bsp(ops, count, deadline);
+	else
+		for (; i < count && ret == 0; i++)
+			ret = __ec_op_pio(&ops [i], deadline);
+
+	__ec_account(start, count, ret);
+	__unlock_ec();
+
+	return ret;
+}
+
+/* One mailbox transaction: command, optional data byte out (data >= 0),
+ * optional byte in - (Internal) */
+static s32 __ec_xfer(u8 cmd, s32 data, u8 *in)
+{
+	struct bsp_ec_op op;
+	s32 ret;
+
+	op.cmd = cmd;
+	op.flags = (data >= 0 ? BSP_EC_DATA : 0) | (in ? BSP_EC_READ : 0);
+	op.data = data;
+	op.in = 0;
+
+	if ((ret = __ec_ops(&op, 1)) == 0 && in)
+		*in = op.in;
+
+	return ret;
+}
+
+/* Send command, read one data byte - (Internal) */
+s32 __ec_read(u8 cmd, u8 *data)
+{
+	return __ec_xfer(cmd, -1, data);
+}
+
+/* Read one byte for each of count commands in one transaction
+ * - (Internal) */
+s32 __ec_read_seq(const u8 *cmd, u8 *data, u32 count)
+{
+	struct bsp_ec_op ops [BSP_EC_OPS_MAX];
+	u32 i;
+	s32 ret;
+
+	if (!count || count > BSP_EC_OPS_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		ops [i].cmd = cmd [i];
+		ops [i].flags = BSP_EC_READ;
+		ops [i].data = ops [i].in = 0;
+	}
+
+	if ((ret = __ec_ops(ops, count)) < 0)
+		return ret;
+
+	for (i = 0; i < count; i++)
+		data [i] = ops [i].in;
+
+	return 0;
+}
+
+/* Send command - (Internal) */
+s32 __ec_write(u8 cmd)
+{
+	return __ec_xfer(cmd, -1, NULL);
+}
+
+/* Send command followed by one data byte - (Internal) */
+s32 __ec_write_data(u8 cmd, u8 data)
+{
+	return __ec_xfer(cmd, data, NULL);
+}
+
+/* -------------------------- External API --------------------------------- */
+
+/* Measure the EC again and retune mailbox waits */
+s8 SusiECCalibrate(void)
+{
+	s32 ret;
+
+	if (__acquire_pio() < 0)
+		return 0;
+
+	/* The kernel helper waits on the EC itself */
+	if (bsp_io) {
+		susi_err = -EOPNOTSUPP;
+		return 0;
+	}
+
+	if ((ret = __ec_calibrate()) < 0) {
+		susi_err = ret;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Measured latencies and wait phases in use */
+s8 SusiECGetCalibration(SusiECCalibration *cal)
+{
+	if (!cal) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&cal_lock);
+	*cal = ec_cal;
+	pthread_mutex_unlock(&cal_lock);
+
+	return 1;
+}
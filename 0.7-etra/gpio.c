@@ -3,25 +3,17 @@
  *
  * See the SUSI Linux API document for API details.
  *
- * Written specifically for TREK-550. Platform checking
- * and corresponding changes are to be added if support
- * for more platforms are needed.
+ * Pin layout comes from a board descriptor: a flat table indexed by
+ * chip GPIO number giving each pin's bank registers, bit and pin mux
+ * constraint, plus the user pin assignment. Supporting another board
+ * on the same GPIO chip is a new descriptor in boards [].
  */
 
 #include "susi.h"
+#include <string.h>
 
-#define MAX_GPIOS	20
-
-#define MAX_USER_DIS	4
-#define MAX_USER_DOS	4
 #define MAX_USER_GPIOS	8
-
-#define GPIO1X_MIN	10
-#define GPIO1X_MAX	18
-#define GPIO2X_MIN	20
-#define GPIO2X_MAX	28
-#define GPIO3X_MIN	30
-#define GPIO3X_MAX	34
+#define GPIO_BANKS	4	/* Banks 1-3, 0 unused */
 
 #define F75111_ADDR	0x9C	/* F75111 SMBus Address		*/
 #define F75111_REG03	0x03	/* Config and Function Select 	*/
@@ -37,377 +29,447 @@
 #define F75111_REG41	0x41	/* GPIO3x Output Data Reg 	*/
 #define F75111_REG42	0x42	/* GPIO3x Input Data Reg 	*/
 
-/* GPIOs available to user */
-
-static u8 gpios [8] = {16, 17, 20, 21, 25, 26, 27, 15};
+#define F75111_PINS	34	/* GPIO10 - GPIO33 */
+
+#define GPIO_REGS_MAX	(3 * (GPIO_BANKS - 1))	/* ctrl/data/drive per bank */
+
+/* GPIO bank registers */
+
+struct gpio_bank {
+	u8 ctrl;		/* Output control, bit set = output */
+	u8 data;		/* Output data */
+	u8 input;		/* Input data */
+	u8 drive;		/* Output driving enable, 0 if none */
+};
+
+/* GPIO pin, bank 0 marks an unused slot */
+
+struct gpio_pin {
+	u8 bank;
+	u8 bit;
+	u8 mux_reg;		/* GPIO only while (mux_reg & mux_mask) == 0 */
+	u8 mux_mask;
+};
+
+/* Board descriptor */
+
+struct gpio_board {
+	const char *name;
+	u8 addr;				/* GPIO chip SMBus address */
+	u8 nbanks;
+	const struct gpio_bank *banks;		/* Indexed by bank number */
+	u8 npins;
+	const struct gpio_pin *pins;		/* Indexed by chip GPIO */
+	u8 nuser;
+	u8 ndi;					/* First ndi user pins are inputs */
+	u8 user [MAX_USER_GPIOS];		/* Chip GPIO per user pin */
+};
+
+#define PIN(bank, bit)	[(bank) * 10 + (bit)] = { bank, bit, 0, 0 }
+
+static const struct gpio_bank f75111_banks [GPIO_BANKS] = {
+	[1] = { F75111_REG10, F75111_REG11, F75111_REG12, F75111_REG1B },
+	[2] = { F75111_REG20, F75111_REG21, F75111_REG22, F75111_REG2B },
+	[3] = { F75111_REG40, F75111_REG41, F75111_REG42, 0 },
+};
+
+static const struct gpio_pin f75111_pins [F75111_PINS] = {
+	PIN(1, 0), PIN(1, 1), PIN(1, 3), PIN(1, 4), 
+	PIN(1, 5), PIN(1, 6), PIN(1, 7),
+
+	/* GPIO12 is shared with other functions in config reg */
+	[12] = { 1, 2, F75111_REG03, 0x18 },
+
+	PIN(2, 0), PIN(2, 1), PIN(2, 2), PIN(2, 3),
+	PIN(2, 4), PIN(2, 5), PIN(2, 6), PIN(2, 7),
+
+	PIN(3, 0), PIN(3, 1), PIN(3, 2), PIN(3, 3),
+};
+
+static const struct gpio_board boards [] = {
+	{
+		.name	= "TREK-550",
+		.addr	= F75111_ADDR,
+		.nbanks	= GPIO_BANKS,
+		.banks	= f75111_banks,
+		.npins	= F75111_PINS,
+		.pins	= f75111_pins,
+		.nuser	= 8,
+		.ndi	= 4,
+		.user	= {16, 17, 20, 21, 25, 26, 27, 15},
+	},
+};
+
+static const struct gpio_board *board = &boards [0];
+
+/* Staged GPIO changes, one transaction per thread */
+
+struct gpio_txn {
+	u8 active;
+	u8 dir_mask [GPIO_BANKS];	/* Bits with a staged direction */
+	u8 dir_out [GPIO_BANKS];	/* Staged directions, 1 = output */
+	u8 lvl_mask [GPIO_BANKS];	/* Bits with a staged level */
+	u8 lvl_val [GPIO_BANKS];	/* Staged levels */
+	u32 io_mask, io_status;		/* User pin levels, for the cache */
+};
+
+static __thread struct gpio_txn txn;
 
 /* Globals */
 
-extern int smbus_fd;
-extern int kernel_fd;
-extern int susi_err;
+extern __thread int susi_err;
+
+extern s32 __acquire_smbus(void);
+extern s32 __smbus_hold(void);
+extern s32 __smbus_run_held(SusiSMBusXfer *ops, u32 count);
+extern void __smbus_release(void);
+extern void __cache_io(u32 mask, u32 status);
 
 /* -------------------------- Internal API --------------------------------- */
 
-/* Count ones in a byte - (Internal) */
-static inline u8 __c1s(u8 byte)
+/* Look up chip GPIO - (Internal) */
+static inline const struct gpio_pin *__gpio_pin(u8 gpio)
 {
-	u8 count = 0;
-
-	for (; byte; count++)
-		byte &= byte - 1;
+	if (gpio >= board->npins || !board->pins [gpio].bank)
+		return NULL;
 
-	return count;
+	return &board->pins [gpio];
 }
 
-/* Read GPIO Control Regs - (Internal) */
-static s8 __read_gpio_ctrls(u8 *gpio10, u8 *gpio20, u8 *gpio30)
+/* Check the pin is muxed as GPIO - (Internal) */
+static s32 __gpio_mux_ok(const struct gpio_pin *p)
 {
+	u8 mux = 0;
 
-	/* Read GPIO1x Output Control Reg */
-	if (SusiSMBusReadByte(F75111_ADDR, F75111_REG10, gpio10) < 0)
-		return -1;
-
-	/* Read GPIO2x Output Control Reg */
-	if (SusiSMBusReadByte(F75111_ADDR, F75111_REG20, gpio20) < 0)
-		return -1;
+	if (!p->mux_mask)
+		return 0;
 
-	/* Read GPIO3x Output Control Reg */
-	if (SusiSMBusReadByte(F75111_ADDR, F75111_REG40, gpio30) < 0)
-		return -1;
+	if (!SusiSMBusReadByte(board->addr, p->mux_reg, &mux))
+		return susi_err;
 
-	return 0;
+	return (mux & p->mux_mask) ? -EINVAL : 0;
 }
 
-/* Count GPIOs - (Internal) */
-static s8 __cnt_gpios(u32 *incnt, u32 *outcnt)
+/* Read several registers in one transaction, bus held - (Internal) */
+static s32 __read_regs(const u8 *regs, u8 *vals, u32 n)
 {
-	u8 gpio10 = 0, gpio20 = 0, gpio30 = 0;
-
-	if (smbus_fd < 0 || !incnt || !outcnt)
-		return -1;
+	SusiSMBusXfer ops [GPIO_REGS_MAX];
+	u32 i = 0;
+	s32 ret;
+
+	for (; i < n; i++) {
+		ops [i].address = board->addr;
+		ops [i].flags = SUSI_XFER_READ;
+		ops [i].cmd = regs [i];
+		ops [i].len = 1;
+	}
 
-	if (__read_gpio_ctrls(&gpio10, &gpio20, &gpio30) < 0)
-		return -1;
+	if ((ret = __smbus_run_held(ops, n)) < 0)
+		return ret;
 
-	*outcnt = __c1s(gpio10) + __c1s(gpio20) + __c1s(gpio30);
-	*incnt = MAX_GPIOS - *outcnt;
+	for (i = 0; i < n; i++)
+		vals [i] = ops [i].data [0];
 
 	return 0;
 }
 
-/* Set GPIO direction - (Internal) */
-s8 __set_gpio_direction(u8 pin, u8 dir)
+/* Write the registers whose value changes, in order, in one 
+ * transaction, bus held - (Internal) */
+static s32 __write_regs(const u8 *regs, const u8 *old, const u8 *next, u32 n)
 {
-	u8 gpio = 0;
-
-	if (smbus_fd < 0 || kernel_fd < 0 || pin < GPIO1X_MIN ||
-	    pin > GPIO3X_MAX - 1 || (dir != 0 && dir != 1))
-		return -EINVAL;
-
-	debug("%s: Set pin %d to %d\n", __FUNC__, pin, dir);
-
-	/* GPIO1x range */
-	if (pin < GPIO1X_MAX) {
-
-		pin -= GPIO1X_MIN;
-
-		/* Check GPIO12 special case */
-		if (pin == 2) {
-			if (SusiSMBusReadByte(F75111_ADDR, F75111_REG03, &gpio) < 0)
-				return -1;
-
-			if ((gpio & 0x18) >> 2)
-				return -EINVAL;
-		}
-
-		if (SusiSMBusReadByte(F75111_ADDR, F75111_REG10, &gpio) < 0)
-			return -1;
+	SusiSMBusXfer ops [GPIO_REGS_MAX];
+	u32 i = 0, count = 0;
+
+	for (; i < n; i++) {
+		if (old [i] == next [i])
+			continue;
+
+		ops [count].address = board->addr;
+		ops [count].flags = SUSI_XFER_WRITE;
+		ops [count].cmd = regs [i];
+		ops [count].len = 1;
+		ops [count].data [0] = next [i];
+		count++;
+	}
 
-		if (dir)
-			gpio &= ~(1 << pin);
-		else
-			gpio |= (1 << pin);
+	return count ? __smbus_run_held(ops, count) : 0;
+}
 
-		if (SusiSMBusWriteByte(F75111_ADDR, F75111_REG10, gpio) < 0)
-			return -1;
+/* Update a register under mask, skipping unchanged writes - (Internal) */
+static s32 __update_reg(u8 reg, u8 mask, u8 value)
+{
+	u8 gpio = 0, next;
+	s32 ret;
 
-	/* GPIO2x range */
-	} else if (pin >= GPIO2X_MIN && pin < GPIO2X_MAX) {
-		if (SusiSMBusReadByte(F75111_ADDR, F75111_REG20, &gpio) < 0)
-			return -1;
+	/* One bus hold, so no other writer slips in between */
+	if ((ret = __smbus_hold()) < 0)
+		return ret;
 
-		pin -= GPIO2X_MIN;
+	if ((ret = __read_regs(&reg, &gpio, 1)) == 0) {
+		next = (gpio & ~mask) | (value & mask);
+		ret = __write_regs(&reg, &gpio, &next, 1);
+	}
 
-		if (dir)
-			gpio &= ~(1 << pin);
-		else
-			gpio |= (1 << pin);
+	__smbus_release();
 
-		if (SusiSMBusWriteByte(F75111_ADDR, F75111_REG20, gpio) < 0)
-			return -1;
+	return ret;
+}
 
-	/* GPIO3x range */
-	} else if (pin >= GPIO3X_MIN && pin < GPIO3X_MAX) {
-		if (SusiSMBusReadByte(F75111_ADDR, F75111_REG40, &gpio) < 0)
-			return -1;
+/* Set GPIO direction - (Internal) */
+s32 __set_gpio_direction(u8 gpio, u8 dir)
+{
+	const struct gpio_pin *p = __gpio_pin(gpio);
+	s32 ret;
 
-		pin -= GPIO3X_MIN;
+	if (!p || (dir != GPIO_OUTPUT && dir != GPIO_INPUT))
+		return -EINVAL;
 
-		if (dir)
-			gpio &= ~(1 << pin);
-		else
-			gpio |= (1 << pin);
+	debug("%s: Set pin %d to %d\n", __FUNC__, gpio, dir);
 
-		if (SusiSMBusWriteByte(F75111_ADDR, F75111_REG40, gpio) < 0)
-			return -1;
-	} else 
-		return -EINVAL;
+	if ((ret = __gpio_mux_ok(p)) < 0)
+		return ret;
 
-	return 0;
+	return __update_reg(board->banks [p->bank].ctrl, 1 << p->bit,
+			    dir == GPIO_OUTPUT ? 1 << p->bit : 0);
 }
 
 /* Read GPIO Status - (Internal) */
-static s8 __read_gpio(u8 pin, u8 *status)
+static s32 __read_gpio(u8 gpio, u8 *status)
 {
-	u8 gpio = 0;
+	const struct gpio_pin *p = __gpio_pin(gpio);
+	const struct gpio_bank *b;
+	u8 regs [3], vals [3];
+	s32 ret;
 
-	if (smbus_fd < 0 || kernel_fd < 0 || !status || pin < GPIO1X_MIN || 
-	    pin > GPIO3X_MAX - 1)
+	if (!p || !status)
 		return -EINVAL;
 
-	/* GPIO1x range */
-	if (pin < GPIO1X_MAX) {
-
-		pin -= GPIO1X_MIN;
-
-		/* Check GPIO12 special case */
-		if (pin == 2) {
-			if (SusiSMBusReadByte(F75111_ADDR, F75111_REG03, &gpio) < 0)
-				return -1;
-
-			if ((gpio & 0x18) >> 2)
-				return -EINVAL;
-		}
-
-		if (SusiSMBusReadByte(F75111_ADDR, F75111_REG10, &gpio) < 0)
-			return -1;
-
-		if (gpio & (1 << pin)) {
-			/* Output */
+	if ((ret = __gpio_mux_ok(p)) < 0)
+		return ret;
 
-			if (SusiSMBusReadByte(F75111_ADDR, F75111_REG11, &gpio) < 0)
-				return -1;
+	b = &board->banks [p->bank];
+	regs [0] = b->ctrl;
+	regs [1] = b->data;
+	regs [2] = b->input;
 
-			*status = gpio & (1 << pin);
-		} else {
-			/* Input */
+	if ((ret = __smbus_hold()) < 0)
+		return ret;
 
-			if (SusiSMBusReadByte(F75111_ADDR, F75111_REG12, &gpio) < 0)
-				return -1;
+	ret = __read_regs(regs, vals, 3);
+	__smbus_release();
 
-			*status = gpio & (1 << pin);
-		}
+	if (ret < 0)
+		return ret;
 
-	/* GPIO2x range */
-	} else if (pin >= GPIO2X_MIN && pin < GPIO2X_MAX) {
+	/* Outputs read back the data reg, inputs the input reg */
+	*status = (vals [vals [0] & (1 << p->bit) ? 1 : 2] >> p->bit) & 1;
 
-		if (SusiSMBusReadByte(F75111_ADDR, F75111_REG20, &gpio) < 0)
-			return -1;
+	return 0;
+}
 
-		pin -= GPIO2X_MIN;
+/* Level registers of a bank: data, then drive enable if any - 
+ * (Internal) */
+static u32 __bank_level_regs(const struct gpio_bank *b, u8 *regs)
+{
+	regs [0] = b->data;
+	regs [1] = b->drive;
 
-		if (gpio & (1 << pin)) {
-			/* Output */
+	return b->drive ? 2 : 1;
+}
 
-			if (SusiSMBusReadByte(F75111_ADDR, F75111_REG21, &gpio) < 0)
-				return -1;
+/* Apply a masked update to register values - (Internal) */
+static void __mask_regs(const u8 *old, u8 *next, u32 n, u8 mask, u8 value)
+{
+	u32 i = 0;
 
-			*status = gpio & (1 << pin);
-		} else {
-			/* Input */
+	for (; i < n; i++)
+		next [i] = (old [i] & ~mask) | (value & mask);
+}
 
-			if (SusiSMBusReadByte(F75111_ADDR, F75111_REG22, &gpio) < 0)
-				return -1;
+/* Write the output levels of several pins in one bank at once - (Internal) */
+s32 __write_gpio_bank(u8 bank, u8 mask, u8 value)
+{
+	u8 regs [3], old [3], next [3];
+	u32 n;
+	s32 ret;
 
-			*status = gpio & (1 << pin);
-		}
+	if (!bank || bank >= board->nbanks)
+		return -EINVAL;
 
-	/* GPIO3x range */
-	} else if (pin >= GPIO3X_MIN && pin < GPIO3X_MAX) {
-		if (SusiSMBusReadByte(F75111_ADDR, F75111_REG40, &gpio) < 0)
-			return -1;
+	debug("%s: Bank %d mask 0x%x value 0x%x\n", __FUNC__, bank, mask, value);
 
-		pin -= GPIO3X_MIN;
+	/* Control reg and level regs in one read */
+	regs [0] = board->banks [bank].ctrl;
+	n = 1 + __bank_level_regs(&board->banks [bank], regs + 1);
 
-		if (gpio & (1 << pin)) {
-			/* Output */
+	if ((ret = __smbus_hold()) < 0)
+		return ret;
 
-			if (SusiSMBusReadByte(F75111_ADDR, F75111_REG41, &gpio) < 0)
-				return -1;
+	/* Output pins only */
+	if ((ret = __read_regs(regs, old, n)) == 0 && (old [0] & mask) != mask)
+		ret = -EINVAL;
 
-			*status = gpio & (1 << pin);
-		} else {
-			/* Input */
+	if (ret == 0) {
+		next [0] = old [0];
+		__mask_regs(old + 1, next + 1, n - 1, mask, value);
+		ret = __write_regs(regs, old, next, n);
+	}
 
-			if (SusiSMBusReadByte(F75111_ADDR, F75111_REG42, &gpio) < 0)
-				return -1;
+	__smbus_release();
 
-			*status = gpio & (1 << pin);
-		}
-	} else 
-		return -EINVAL;
-
-	return 0;
+	return ret;
 }
 
 /* Write GPIO status - (Internal) */
-s8 __write_gpio(u8 pin, u8 status)
+s32 __write_gpio(u8 gpio, u8 status)
 {
-	u8 gpio = 0;
+	const struct gpio_pin *p = __gpio_pin(gpio);
+	u8 regs [3], old [3], next [3];
+	u32 n;
+	s32 ret;
 
-	if (smbus_fd < 0 || kernel_fd < 0 || pin < GPIO1X_MIN || 
-	    pin > GPIO3X_MAX - 1 || (status != 0 && status != 1))
+	if (!p || (status != GPIO_LOW && status != GPIO_HIGH))
 		return -EINVAL;
 
-	debug("%s: Set pin %d to %d\n", __FUNC__, pin, status);
+	debug("%s: Set pin %d to %d\n", __FUNC__, gpio, status);
 
-	/* GPIO1x range */
-	if (pin < GPIO1X_MAX) {
+	if ((ret = __gpio_mux_ok(p)) < 0)
+		return ret;
 
-		pin -= GPIO1X_MIN;
-
-		/* Check GPIO12 special case */
-		if (pin == 2) {
-			if (SusiSMBusReadByte(F75111_ADDR, F75111_REG03, &gpio) < 0)
-				return -1;
-
-			if ((gpio & 0x18) >> 2)
-				return -EINVAL;
-		}
+	/* Control reg and level regs in one read */
+	regs [0] = board->banks [p->bank].ctrl;
+	n = 1 + __bank_level_regs(&board->banks [p->bank], regs + 1);
 
-		if (SusiSMBusReadByte(F75111_ADDR, F75111_REG10, &gpio) < 0)
-			return -1;
+	if ((ret = __smbus_hold()) < 0)
+		return ret;
 
-		if (gpio & (1 << pin)) {
-			/* Output */
+	/* Output pins only */
+	if ((ret = __read_regs(regs, old, n)) == 0 && !(old [0] & (1 << p->bit)))
+		ret = -EINVAL;
 
-			if (status) {
-				if (SusiSMBusReadByte(F75111_ADDR, F75111_REG11, &gpio) < 0)
-					return -1;
-
-				gpio |= (1 << pin);
-
-				if (SusiSMBusWriteByte(F75111_ADDR, F75111_REG11, gpio) < 0)
-					return -1;
-
-				if (SusiSMBusReadByte(F75111_ADDR, F75111_REG1B, &gpio) < 0)
-					return -1;
-
-				gpio |= (1 << pin);
+	if (ret == 0) {
+		next [0] = old [0];
+		__mask_regs(old + 1, next + 1, n - 1, 1 << p->bit, 
+			    status ? 1 << p->bit : 0);
+		ret = __write_regs(regs, old, next, n);
+	}
 
-				if (SusiSMBusWriteByte(F75111_ADDR, F75111_REG1B, gpio) < 0)
-					return -1;
-			} else {
-				if (SusiSMBusReadByte(F75111_ADDR, F75111_REG11, &gpio) < 0)
-					return -1;
+	__smbus_release();
 
-				gpio &= ~(1 << pin);
+	return ret;
+}
 
-				if (SusiSMBusWriteByte(F75111_ADDR, F75111_REG11, gpio) < 0)
-					return -1;
+/* Map user pin to GPIO bank and bit - (Internal) */
+s32 __gpio_user_map(u8 pin, u8 *bank, u8 *bit)
+{
+	const struct gpio_pin *p;
 
-				if (SusiSMBusReadByte(F75111_ADDR, F75111_REG1B, &gpio) < 0)
-					return -1;
+	if (pin >= board->nuser || !(p = __gpio_pin(board->user [pin])))
+		return -EINVAL;
 
-				gpio &= ~(1 << pin);
+	*bank = p->bank;
+	*bit = p->bit;
 
-				if (SusiSMBusWriteByte(F75111_ADDR, F75111_REG1B, gpio) < 0)
-					return -1;
-			}
-		} else
-			return -EINVAL;
+	return 0;
+}
 
-	/* GPIO2x range */
-	} else if (pin >= GPIO2X_MIN && pin < GPIO2X_MAX) {
+/* Stage a direction and / or level change, -1 leaves either as is - 
+ * (Internal) */
+s32 __gpio_txn_stage(u8 gpio, s32 dir, s32 level)
+{
+	const struct gpio_pin *p = __gpio_pin(gpio);
+	u8 bank, bit;
 
-		if (SusiSMBusReadByte(F75111_ADDR, F75111_REG20, &gpio) < 0)
-			return -1;
+	if (!txn.active)
+		return -EPERM;
 
-		pin -= GPIO2X_MIN;
+	if (!p)
+		return -EINVAL;
 
-		if (gpio & (1 << pin)) {
-			/* Output */
+	bank = p->bank;
+	bit = p->bit;
 
-			if (status) {
-				if (SusiSMBusReadByte(F75111_ADDR, F75111_REG21, &gpio) < 0)
-					return -1;
+	debug("%s: Stage pin %d dir %d level %d\n", __FUNC__, gpio, dir, level);
 
-				gpio |= (1 << pin);
+	if (dir >= 0) {
+		txn.dir_mask [bank] |= 1 << bit;
+		if (dir == GPIO_OUTPUT)
+			txn.dir_out [bank] |= 1 << bit;
+		else
+			txn.dir_out [bank] &= ~(1 << bit);
+	}
 
-				if (SusiSMBusWriteByte(F75111_ADDR, F75111_REG21, gpio) < 0)
-					return -1;
+	if (level >= 0) {
+		txn.lvl_mask [bank] |= 1 << bit;
+		if (level)
+			txn.lvl_val [bank] |= 1 << bit;
+		else
+			txn.lvl_val [bank] &= ~(1 << bit);
+	}
 
-				if (SusiSMBusReadByte(F75111_ADDR, F75111_REG2B, &gpio) < 0)
-					return -1;
+	return 0;
+}
 
-				gpio |= (1 << pin);
+/* Apply staged changes, validating every bank before writing, bus
+ * held - (Internal) */
+static s32 __gpio_txn_apply(const struct gpio_txn *t)
+{
+	u8 regs [GPIO_REGS_MAX], old [GPIO_REGS_MAX], next [GPIO_REGS_MAX];
+	u8 ctrl, bank;
+	u32 n = 0, nb, first;
+	s32 ret;
+
+	/* Level regs then control reg of every touched bank, so a single
+	 * write pass applies levels before directions: new outputs start
+	 * at their level and outputs being released are driven there first */
+	for (bank = 1; bank < board->nbanks; bank++) {
+		if (!t->dir_mask [bank] && !t->lvl_mask [bank])
+			continue;
+
+		n += __bank_level_regs(&board->banks [bank], regs + n);
+		regs [n++] = board->banks [bank].ctrl;
+	}
 
-				if (SusiSMBusWriteByte(F75111_ADDR, F75111_REG2B, gpio) < 0)
-					return -1;
-			} else {
-				if (SusiSMBusReadByte(F75111_ADDR, F75111_REG21, &gpio) < 0)
-					return -1;
+	if (!n)
+		return 0;
 
-				gpio &= ~(1 << pin);
+	if ((ret = __read_regs(regs, old, n)) < 0)
+		return ret;
 
-				if (SusiSMBusWriteByte(F75111_ADDR, F75111_REG21, gpio) < 0)
-					return -1;
+	for (bank = 1, first = 0; bank < board->nbanks; bank++) {
+		if (!t->dir_mask [bank] && !t->lvl_mask [bank])
+			continue;
 
-				if (SusiSMBusReadByte(F75111_ADDR, F75111_REG2B, &gpio) < 0)
-					return -1;
+		nb = __bank_level_regs(&board->banks [bank], regs + first);
+		ctrl = first + nb;
 
-				gpio &= ~(1 << pin);
+		__mask_regs(old + first, next + first, nb, t->lvl_mask [bank],
+			    t->lvl_val [bank]);
+		__mask_regs(old + ctrl, next + ctrl, 1, t->dir_mask [bank],
+			    t->dir_out [bank]);
 
-				if (SusiSMBusWriteByte(F75111_ADDR, F75111_REG2B, gpio) < 0)
-					return -1;
-			}
-		} else
+		/* Levels only apply to pins that are outputs before or after */
+		if (t->lvl_mask [bank] & ~(old [ctrl] | next [ctrl]))
 			return -EINVAL;
 
-	/* GPIO3x range */
-	} else if (pin >= GPIO3X_MIN && pin < GPIO3X_MAX) {
-		if (SusiSMBusReadByte(F75111_ADDR, F75111_REG40, &gpio) < 0)
-			return -1;
-
-		pin -= GPIO3X_MIN;
-
-		if (gpio & (1 << pin)) {
-			/* Output */
-
-			if (status) {
-				if (SusiSMBusReadByte(F75111_ADDR, F75111_REG41, &gpio) < 0)
-					return -1;
+		first = ctrl + 1;
+	}
 
-				gpio |= (1 << pin);
+	return __write_regs(regs, old, next, n);
+}
 
-				if (SusiSMBusWriteByte(F75111_ADDR, F75111_REG41, gpio) < 0)
-					return -1;
-			} else {
-				if (SusiSMBusReadByte(F75111_ADDR, F75111_REG41, &gpio) < 0)
-					return -1;
+/* Apply staged changes under one bus hold - (Internal) */
+static s32 __gpio_txn_commit(const struct gpio_txn *t)
+{
+	s32 ret;
 
-				gpio &= ~(1 << pin);
+	if ((ret = __smbus_hold()) < 0)
+		return ret;
 
-				if (SusiSMBusWriteByte(F75111_ADDR, F75111_REG41, gpio) < 0)
-					return -1;
-			}
-		} else
-			return -EINVAL;
-	} else
-		return -EINVAL;
+	ret = __gpio_txn_apply(t);
+	__smbus_release();
 
-	return 0;
+	return ret;
 }
 
 /* -------------------------- External API --------------------------------- */
@@ -415,29 +477,26 @@ s8 __write_gpio(u8 pin, u8 status)
 /* Check if GPIO is available */
 u8 SusiIOAvailable(void)
 {
-	if (smbus_fd >= 0 && kernel_fd >= 0) 
+	if (__acquire_smbus() >= 0)
 		return 1;
-	else {
-		susi_err = -EAGAIN;
+	else
 		return -1;
-	}
 }
 
 /* Count GPIOs */
 s8 SusiIOCountEx(u32 *incnt, u32 *outcnt)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) { 
-		susi_err = -EAGAIN;
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
 	if (!incnt || !outcnt) {
 		susi_err = -EINVAL;
 		return 0;
 	}
 
-	/* 4 Input / Output GPIOS */
-	*incnt = *outcnt = 4;
+	/* Fixed inputs / outputs */
+	*incnt = board->ndi;
+	*outcnt = board->nuser - board->ndi;
 
 	return 1;
 }
@@ -445,10 +504,8 @@ s8 SusiIOCountEx(u32 *incnt, u32 *outcnt)
 /* Query various masks */
 s8 SusiIOQueryMask(u32 flag, u32 *mask)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
 	if (!mask) {
 		susi_err = -EINVAL;
@@ -458,14 +515,14 @@ s8 SusiIOQueryMask(u32 flag, u32 *mask)
 	/* Check mask requested */
 	switch (flag) {
 		case ESIO_SMASK_PIN_FULL:
-			*mask = 0xFF;
+			*mask = (1 << board->nuser) - 1;
 			break;
 		case ESIO_SMASK_CONFIGURABLE:
 			*mask = 0;
 			break;
 		case ESIO_DMASK_DIRECTION:
-			*mask = 0xF; 
-			break; 
+			*mask = (1 << board->ndi) - 1;
+			break;
 		default:
 			susi_err = -EINVAL;
 			return 0;
@@ -477,40 +534,20 @@ s8 SusiIOQueryMask(u32 flag, u32 *mask)
 /* Set GPIO direction */
 s8 SusiIOSetDirection(u8 pin, u8 dir, u32 *pinmask)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
-	if (pin < 0 || pin > MAX_USER_GPIOS - 1 || (dir != 0 && dir != 1)) {
+	if (pin >= board->nuser || (dir != GPIO_OUTPUT && dir != GPIO_INPUT)) {
 		susi_err = -EINVAL;
 		return 0;
 	}
 
 	debug("%s: Set pin %d to %d\n", __FUNC__, pin, dir);
 
-	switch (pin) {
-		case 0:
-		case 1:
-		case 2:
-		case 3:
-			if (!dir) {
-				susi_err = -EINVAL;
-				return 0;
-			}
-			break;
-		case 4:
-		case 5:
-		case 6:
-		case 7:
-			if (dir) {
-				susi_err = -EINVAL;
-				return 0;
-			}
-			break;
-		default:
-			susi_err = -EINVAL;
-			return 0;
+	/* Directions are fixed, inputs first */
+	if ((pin < board->ndi) != (dir == GPIO_INPUT)) {
+		susi_err = -EINVAL;
+		return 0;
 	}
 
 	/* Return mask */
@@ -526,10 +563,8 @@ s8 SusiIOSetDirectionMulti(u32 targetmask, u32 *pinmask)
 {
 	u8 i = 0;
 
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
 	if (!pinmask) {
 		susi_err = -EINVAL;
@@ -537,7 +572,7 @@ s8 SusiIOSetDirectionMulti(u32 targetmask, u32 *pinmask)
 	}
 
 	/* Run through mask */
-	for (; i < MAX_USER_GPIOS; i++)
+	for (; i < board->nuser; i++)
 		if (targetmask & (1 << i))
 			if (!SusiIOSetDirection(i, 
 			   ((*pinmask & (1 << i)) == (1 << i)), NULL))
@@ -554,19 +589,22 @@ s8 SusiIOSetDirectionMulti(u32 targetmask, u32 *pinmask)
 /* Read GPIO Status */
 s8 SusiIOReadEx(u8 pin, u8 *status)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
-	if (!status || pin < 0 || pin > MAX_USER_GPIOS - 1) {
+	if (!status || pin >= board->nuser) {
 		susi_err = -EINVAL;
 		return 0;
 	}
 
-	susi_err = __read_gpio(gpios [pin], status);
+	susi_err = __read_gpio(board->user [pin], status);
+
+	if (susi_err < 0)
+		return 0;
+
+	__cache_io(1 << pin, *status ? 1 << pin : 0);
 
-	return (susi_err >= 0) ? 1 : 0;
+	return 1;
 }
 
 /* Read multiple GPIOs */
@@ -574,10 +612,8 @@ s8 SusiIOReadMultiEx(u32 targetmask, u32 *statusmask)
 {
 	u8 i = 0, status = 0;
 
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
 	if (!statusmask) {
 		susi_err = -EINVAL;
@@ -587,7 +623,7 @@ s8 SusiIOReadMultiEx(u32 targetmask, u32 *statusmask)
 	*statusmask = 0;
 
 	/* Run through mask */
-	for (; i < MAX_USER_GPIOS; i++)
+	for (; i < board->nuser; i++)
 		if (targetmask & (1 << i)) {
 			if (!SusiIOReadEx(i, &status))
 				return 0;
@@ -602,19 +638,23 @@ s8 SusiIOReadMultiEx(u32 targetmask, u32 *statusmask)
 /* Write GPIO Status */
 s8 SusiIOWriteEx(u8 pin, u8 status)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
-	if (!status || pin < MAX_USER_DOS || pin > MAX_USER_GPIOS - 1) {
+	if ((status != GPIO_LOW && status != GPIO_HIGH) || 
+	    pin < board->ndi || pin >= board->nuser) {
 		susi_err = -EINVAL;
 		return 0;
 	}
 
-	susi_err = __write_gpio(gpios [pin], status);
+	susi_err = __write_gpio(board->user [pin], status);
+
+	if (susi_err < 0)
+		return 0;
+
+	__cache_io(1 << pin, status ? 1 << pin : 0);
 
-	return (susi_err >= 0) ? 1 : 0;
+	return 1;
 }
 
 /* Write multiple GPIOs */
@@ -622,16 +662,116 @@ s8 SusiIOWriteMultiEx(u32 targetmask, u32 statusmask)
 {
 	u8 i = 0;
 
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_smbus() < 0)
+		return 0;
+
+	/* Run through mask */
+	for (; i < board->nuser; i++)
+		if (targetmask & (1 << i))
+			if (!SusiIOWriteEx(i, (statusmask >> i) & 1))
+				return 0;
+
+	return 1;
+}
+
+/* Start staging GPIO changes for this thread */
+s8 SusiIOTxnBegin(void)
+{
+	if (__acquire_smbus() < 0)
+		return 0;
+
+	if (txn.active) {
+		susi_err = -EBUSY;
+		return 0;
+	}
+
+	memset(&txn, 0, sizeof(txn));
+	txn.active = 1;
+
+	return 1;
+}
+
+/* Stage GPIO direction */
+s8 SusiIOTxnSetDirection(u8 pin, u8 dir)
+{
+	/* Same fixed directions as SusiIOSetDirection */
+	if (pin >= board->nuser || (dir != GPIO_OUTPUT && dir != GPIO_INPUT) ||
+	    (pin < board->ndi) != (dir == GPIO_INPUT)) {
+		susi_err = -EINVAL;
 		return 0;
 	}
 
+	if ((susi_err = __gpio_txn_stage(board->user [pin], dir, -1)) < 0)
+		return 0;
+
+	return 1;
+}
+
+/* Stage GPIO status */
+s8 SusiIOTxnWrite(u8 pin, u8 status)
+{
+	if (pin < board->ndi || pin >= board->nuser ||
+	    (status != GPIO_LOW && status != GPIO_HIGH)) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	if ((susi_err = __gpio_txn_stage(board->user [pin], -1, status)) < 0)
+		return 0;
+
+	txn.io_mask |= 1 << pin;
+	if (status)
+		txn.io_status |= 1 << pin;
+	else
+		txn.io_status &= ~(1 << pin);
+
+	return 1;
+}
+
+/* Stage multiple GPIO statuses */
+s8 SusiIOTxnWriteMulti(u32 targetmask, u32 statusmask)
+{
+	u8 i = 0;
+
 	/* Run through mask */
-	for (; i < MAX_USER_GPIOS; i++)
+	for (; i < board->nuser; i++)
 		if (targetmask & (1 << i))
-			if (!SusiIOWriteEx(i, (statusmask & (1 << i))))
+			if (!SusiIOTxnWrite(i, (statusmask >> i) & 1))
 				return 0;
 
 	return 1;
 }
+
+/* Commit staged changes, ends the transaction either way */
+s8 SusiIOTxnCommit(void)
+{
+	struct gpio_txn t = txn;
+
+	if (!txn.active) {
+		susi_err = -EPERM;
+		return 0;
+	}
+
+	memset(&txn, 0, sizeof(txn));
+
+	if ((susi_err = __gpio_txn_commit(&t)) < 0)
+		return 0;
+
+	if (t.io_mask)
+		__cache_io(t.io_mask, t.io_status);
+
+	return 1;
+}
+
+/* Drop staged changes */
+s8 SusiIOTxnAbort(void)
+{
+	if (!txn.active) {
+		susi_err = -EPERM;
+		return 0;
+	}
+
+	memset(&txn, 0, sizeof(txn));
+
+	return 1;
+}
@@ -0,0 +1,232 @@
+/* SUSI Library - Sensor History
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ * Fixed-size history of every sensor reading taken by this process:
+ * a ring of raw samples plus 1 s, 1 min and 1 h rollups. Rollups are
+ * updated as each sample is added, so queries only copy or combine
+ * a bounded number of buckets.
+ */
+
+#include "susi.h"
+#include <pthread.h>
+#include <string.h>
+
+#define HIST_RAW_LEN		256
+#define HIST_SEC_LEN		120	/* 2 min of 1 s buckets */
+#define HIST_MIN_LEN		120	/* 2 h of 1 min buckets */
+#define HIST_HOUR_LEN		48	/* 2 days of 1 h buckets */
+
+#define NS_PER_SEC		1000000000ULL
+
+/* Rollup bucket */
+struct hist_bucket {
+	u64 start;
+	flt min, max;
+	double sum;
+	u32 count;
+};
+
+/* Ring of buckets at one resolution */
+struct hist_ring {
+	struct hist_bucket *b;
+	u32 len;
+	u32 head;		/* Newest bucket */
+	u32 used;
+	u64 width;		/* ns, 0 for raw samples */
+};
+
+/* Per-sensor history */
+struct hist_sensor {
+	pthread_mutex_t lock;
+	struct hist_bucket raw [HIST_RAW_LEN];
+	struct hist_bucket sec [HIST_SEC_LEN];
+	struct hist_bucket min [HIST_MIN_LEN];
+	struct hist_bucket hour [HIST_HOUR_LEN];
+	struct hist_ring ring [SUSI_HIST_MAX];
+};
+
+/* Globals */
+
+extern __thread int susi_err;
+
+static struct hist_sensor hist [SUSI_SENSOR_MAX];
+static pthread_once_t hist_once = PTHREAD_ONCE_INIT;
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* Wire up rings - (Internal) */
+static void __hist_init(void)
+{
+	struct hist_sensor *h;
+	u32 i = 0;
+
+	for (; i < SUSI_SENSOR_MAX; i++) {
+		h = &hist [i];
+
+		pthread_mutex_init(&h->lock, NULL);
+
+		h->ring [SUSI_HIST_RAW] = (struct hist_ring)
+			{ h->raw, HIST_RAW_LEN, 0, 0, 0 };
+		h->ring [SUSI_HIST_1S] = (struct hist_ring)
+			{ h->sec, HIST_SEC_LEN, 0, 0, NS_PER_SEC };
+		h->ring [SUSI_HIST_1M] = (struct hist_ring)
+			{ h->min, HIST_MIN_LEN, 0, 0, 60 * NS_PER_SEC };
+		h->ring [SUSI_HIST_1H] = (struct hist_ring)
+			{ h->hour, HIST_HOUR_LEN, 0, 0, 3600 * NS_PER_SEC };
+	}
+}
+
+/* Fold a sample into a ring - (Internal) */
+static void __ring_add(struct hist_ring *r, flt value, u64 stamp)
+{
+	struct hist_bucket *b = &r->b [r->head];
+	u64 start = r->width ? stamp - stamp % r->width : stamp;
+
+	/* Open a new bucket unless the sample falls in the newest one */
+	if (!r->used || !r->width || b->start != start) {
+		if (r->used)
+			r->head = (r->head + 1) % r->len;
+		if (r->used < r->len)
+			r->used++;
+
+		b = &r->b [r->head];
+		b->start = start;
+		b->min = b->max = value;
+		b->sum = 0;
+		b->count = 0;
+	}
+
+	if (value < b->min)
+		b->min = value;
+	if (value > b->max)
+		b->max = value;
+
+	b->sum += value;
+	b->count++;
+}
+
+/* Record a sample at all resolutions - (Internal) */
+void __history_add(u32 id, flt value, u64 stamp)
+{
+	struct hist_sensor *h;
+	u32 i = 0;
+
+	if (id >= SUSI_SENSOR_MAX)
+		return;
+
+	pthread_once(&hist_once, __hist_init);
+
+	h = &hist [id];
+
+	pthread_mutex_lock(&h->lock);
+
+	for (; i < SUSI_HIST_MAX; i++)
+		__ring_add(&h->ring [i], value, stamp);
+
+	pthread_mutex_unlock(&h->lock);
+}
+
+/* Check query arguments - (Internal) */
+static s8 __hist_args(u32 sensor, u32 res)
+{
+	if (sensor >= SUSI_SENSOR_MAX || res >= SUSI_HIST_MAX) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	pthread_once(&hist_once, __hist_init);
+
+	return 1;
+}
+
+/* -------------------------- External API --------------------------------- */
+
+/* Copy up to max newest buckets, oldest first */
+s8 SusiHWMHistoryGet(u32 sensor, u32 res, SusiHWMBucket *buf, u32 max,
+		     u32 *count)
+{
+	struct hist_ring *r;
+	struct hist_bucket *b;
+	u32 n, i = 0, idx;
+
+	if (!__hist_args(sensor, res))
+		return 0;
+
+	if (!buf || !count) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	r = &hist [sensor].ring [res];
+
+	pthread_mutex_lock(&hist [sensor].lock);
+
+	n = r->used < max ? r->used : max;
+	idx = (r->head + r->len - n + 1) % r->len;
+
+	for (; i < n; i++, idx = (idx + 1) % r->len) {
+		b = &r->b [idx];
+		buf [i].start = b->start;
+		buf [i].min = b->min;
+		buf [i].max = b->max;
+		buf [i].avg = (flt)(b->sum / b->count);
+		buf [i].count = b->count;
+	}
+
+	pthread_mutex_unlock(&hist [sensor].lock);
+
+	*count = n;
+	return 1;
+}
+
+/* Combine the newest n buckets into one */
+s8 SusiHWMHistoryWindow(u32 sensor, u32 res, u32 n, SusiHWMBucket *out)
+{
+	struct hist_ring *r;
+	struct hist_bucket *b;
+	double sum = 0;
+	u32 i = 0, idx;
+
+	if (!__hist_args(sensor, res))
+		return 0;
+
+	if (!out || !n) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	r = &hist [sensor].ring [res];
+
+	pthread_mutex_lock(&hist [sensor].lock);
+
+	if (!r->used) {
+		pthread_mutex_unlock(&hist [sensor].lock);
+		susi_err = -ENODATA;
+		return 0;
+	}
+
+	if (n > r->used)
+		n = r->used;
+
+	memset(out, 0, sizeof(*out));
+
+	for (idx = r->head; i < n; i++, idx = (idx + r->len - 1) % r->len) {
+		b = &r->b [idx];
+
+		if (!i || b->min < out->min)
+			out->min = b->min;
+		if (!i || b->max > out->max)
+			out->max = b->max;
+
+		out->start = b->start;
+		out->count += b->count;
+		sum += b->sum;
+	}
+
+	pthread_mutex_unlock(&hist [sensor].lock);
+
+	out->avg = (flt)(sum / out->count);
+	return 1;
+}
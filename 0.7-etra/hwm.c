@@ -6,10 +6,6 @@
  */
 
 #include "susi.h"
-#include <stdlib.h>
-
-#define EC_PMC2_CMD			0x6C
-#define EC_PMC2_DAT			0x68
 
 /* Temp / Volt cmds */
 #define EC_PMC2_CMD_TSYS		0xD9
@@ -22,179 +18,234 @@
 #define EC_PMC2_CMD_V33_FLT		0xD1
 #define EC_PMC2_CMD_V33_INT		0xD0
 
-/* Globals */
-
-extern int smbus_fd;
-extern int kernel_fd;
-extern int susi_err;
+/* Sensor kinds */
+#define HWM_TEMP			0
+#define HWM_VOLT			1
+#define HWM_FAN				2
+
+/* Reading encodings */
+#define HWM_ENC_NONE			0xFF	/* No EC command known		*/
+#define HWM_ENC_BYTE			0	/* One byte			*/
+#define HWM_ENC_FIXED			1	/* Integer byte, hundredths byte */
+#define HWM_ENC_WORD			2	/* High byte, low byte		*/
+
+/* Sensor descriptor, indexed by SUSI_SENSOR_* */
+struct hwm_sensor {
+	u8 kind;
+	u16 type;		/* TCPU, VCORE, FCPU ... flag */
+	u8 enc;
+	u8 cmd [2];		/* EC read cmds, first byte first */
+	u8 duty;		/* Fans: EC duty cmd */
+	flt scale;
+};
 
-/* -------------------------- External API --------------------------------- */
+/* Globals */
 
-/* Check if available */
-u8 SusiHWMAvailable(void)
+extern __thread int susi_err;
+
+extern s32 __acquire_pio(void);
+extern s32 __ec_read_seq(const u8 *cmd, u8 *data, u32 count);
+extern s32 __ec_write_data(u8 cmd, u8 data);
+extern void __cache_sensor(u32 id, flt value);
+
+/* Every rail and sensor the EC exposes; the other voltage flags in
+ * susi.h have no EC command on this board */
+static const struct hwm_sensor sensors [SUSI_SENSOR_MAX] = {
+	[SUSI_SENSOR_TCPU] = { HWM_TEMP, TCPU, HWM_ENC_FIXED,
+		{ EC_PMC2_CMD_TCPU_INT, EC_PMC2_CMD_TCPU_FLT }, 0, 1.0f },
+	[SUSI_SENSOR_TSYS] = { HWM_TEMP, TSYS, HWM_ENC_BYTE,
+		{ EC_PMC2_CMD_TSYS }, 0, 1.0f },
+	[SUSI_SENSOR_VCORE] = { HWM_VOLT, VCORE, HWM_ENC_FIXED,
+		{ EC_PMC2_CMD_VCORE_INT, EC_PMC2_CMD_VCORE_FLT }, 0, 1.0f },
+	[SUSI_SENSOR_V33] = { HWM_VOLT, V33, HWM_ENC_FIXED,
+		{ EC_PMC2_CMD_V33_INT, EC_PMC2_CMD_V33_FLT }, 0, 1.0f },
+	[SUSI_SENSOR_V50] = { HWM_VOLT, V50, HWM_ENC_FIXED,
+		{ EC_PMC2_CMD_V50_INT, EC_PMC2_CMD_V50_FLT }, 0, 1.0f },
+	/* The fan speed and duty commands of this EC are not documented;
+	 * fans fail with -ENODEV until they are confirmed against the EC
+	 * firmware. A 16 bit speed is then a HWM_ENC_WORD entry. */
+	[SUSI_SENSOR_FCPU] = { HWM_FAN, FCPU, HWM_ENC_NONE, { 0 }, 0, 1.0f },
+	[SUSI_SENSOR_FSYS] = { HWM_FAN, FSYS, HWM_ENC_NONE, { 0 }, 0, 1.0f },
+};
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* Combine EC integer and hundredths reading - (Internal) */
+static flt __ec_fixed(u8 ipart, u8 fpart)
 {
-	if (smbus_fd >= 0 && kernel_fd >= 0) 
-		return 1;
-	else {
-		susi_err = -EAGAIN;
-		return -1;
-	}
+	/* Matches the "%d.%.2d" formatting the EC values were read with */
+	return (flt)ipart + (flt)fpart / (fpart < 100 ? 100.0f : 1000.0f);
 }
 
-/* Get Fan Speed - Not supported */
-s8 SusiHWMGetFanSpeed(u16 type, u16 *retval, u16 *avail)
+/* Sensor index for a kind and type flag, -EINVAL if none - (Internal) */
+static s32 __hwm_find(u8 kind, u16 type)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
-		return -1;
-	}
+	u32 id;
 
-	if (!retval) {
-		susi_err = -EINVAL;
-		return 0;
-	}
+	for (id = 0; id < SUSI_SENSOR_MAX; id++)
+		if (sensors [id].kind == kind && sensors [id].type == type)
+			return id;
 
-	if (avail)
-		*avail = 0;
+	return -EINVAL;
+}
 
-	*retval = 0;
+/* Type flags available for a kind - (Internal) */
+static u16 __hwm_avail(u8 kind)
+{
+	u16 avail = 0;
+	u32 id;
 
-	susi_err = -ENODEV;
-	return 0;
+	for (id = 0; id < SUSI_SENSOR_MAX; id++)
+		if (sensors [id].kind == kind && sensors [id].enc != HWM_ENC_NONE)
+			avail |= sensors [id].type;
+
+	return avail;
 }
 
-/* Set Fan Speed - Not supported */
-s8 SusiHWMSetFanSpeed(u16 type, u8 setval, u16 *avail)
+/* Read and cache a sensor by SUSI_SENSOR_* index - (Internal) */
+s32 __hwm_read(u32 id, flt *value)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
-		return 0;
+	const struct hwm_sensor *s;
+	u8 b [2] = { 0, 0 };
+	s32 ret;
+
+	if (id >= SUSI_SENSOR_MAX || !value)
+		return -EINVAL;
+
+	s = &sensors [id];
+
+	if (s->enc == HWM_ENC_NONE)
+		return -ENODEV;
+
+	/* Both bytes in one EC transaction */
+	if ((ret = __ec_read_seq(s->cmd, b, s->enc == HWM_ENC_BYTE ? 1 : 2)) < 0)
+		return ret;
+
+	switch (s->enc) {
+		case HWM_ENC_FIXED:
+			*value = __ec_fixed(b [0], b [1]);
+			break;
+		case HWM_ENC_WORD:
+			*value = (flt)((b [0] << 8) | b [1]);
+			break;
+		default:
+			*value = (flt)b [0];
+			break;
 	}
 
-	if (avail)
-		*avail = 0;
+	*value *= s->scale;
+	__cache_sensor(id, *value);
 
-	susi_err = -ENODEV;
 	return 0;
 }
 
-/* Get Temperature sensor data */
-s8 SusiHWMGetTemperature(u16 type, flt *retval, u16 *avail)
+/* Read a sensor by kind and type flag, public API error convention - (Internal) */
+static s8 __hwm_get(u8 kind, u16 type, flt *retval, u16 *avail)
 {
-	u8 ipart = 0, fpart = 0;
-	u8 str [20];
+	s32 ret;
 
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (!retval) {
+		susi_err = -EINVAL;
 		return 0;
 	}
 
-	if (!retval) {
-		susi_err = -EINVAL;
+	if ((ret = __hwm_find(kind, type)) < 0 ||
+	    (ret = __hwm_read(ret, retval)) < 0) {
+		susi_err = ret;
 		return 0;
 	}
 
-	switch(type) {
-		case TCPU:
-			SusiPortIOSetByte(EC_PMC2_CMD, EC_PMC2_CMD_TCPU_INT);
-			sleep(1);
+	if (avail)
+		*avail = __hwm_avail(kind);
 
-			SusiPortIOGetByte(EC_PMC2_DAT, &ipart);
-			debug("%s: Ipart: %d\n", __FUNC__, ipart);
+	return 1;
+}
+
+/* -------------------------- External API --------------------------------- */
 
-			SusiPortIOSetByte(EC_PMC2_CMD, EC_PMC2_CMD_TCPU_FLT);
-			sleep(1);
+/* Check if available */
+u8 SusiHWMAvailable(void)
+{
+	if (__acquire_pio() >= 0)
+		return 1;
+	else
+		return -1;
+}
 
-			SusiPortIOGetByte(EC_PMC2_DAT, &fpart);
-			debug("%s: Fpart: %d\n", __FUNC__, fpart);
+/* Get Fan Speed in RPM */
+s8 SusiHWMGetFanSpeed(u16 type, u16 *retval, u16 *avail)
+{
+	flt rpm;
 
-			sprintf(str, "%d.%.2d", ipart, fpart);
-			*retval = (flt)atof(str);
-			break;
-		case TSYS:
-			SusiPortIOSetByte(EC_PMC2_CMD, EC_PMC2_CMD_TSYS);
-			sleep(1);
+	if (__acquire_pio() < 0)
+		return -1;
 
-			SusiPortIOGetByte(EC_PMC2_DAT, &fpart);
-			*retval = (flt)fpart;
-			break;
-		default:
-			susi_err = -EINVAL;
-			return 0;
+	if (!retval) {
+		susi_err = -EINVAL;
+		return 0;
 	}
 
-	if (avail)
-		*avail = 0x3;
+	if (__hwm_get(HWM_FAN, type, &rpm, avail) != 1)
+		return 0;
+
+	*retval = (u16)rpm;
 
 	return 1;
 }
 
-/* Get Voltage sensor data */
-s8 SusiHWMGetVoltage(u16 type, flt *retval, u16 *avail)
+/* Set Fan duty cycle, 0-100 % */
+s8 SusiHWMSetFanSpeed(u16 type, u8 setval, u16 *avail)
 {
-	u8 ipart = 0, fpart = 0;
-	u8 str [20];
+	s32 ret;
 
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_pio() < 0)
 		return 0;
-	}
 
-	if (!retval) {
+	if (setval > 100) {
 		susi_err = -EINVAL;
 		return 0;
 	}
 
-	switch(type) {
-		case VCORE:
-			SusiPortIOSetByte(EC_PMC2_CMD, EC_PMC2_CMD_VCORE_INT);
-			sleep(1);
-
-			SusiPortIOGetByte(EC_PMC2_DAT, &ipart);
-
-			SusiPortIOSetByte(EC_PMC2_CMD, EC_PMC2_CMD_VCORE_FLT);
-			sleep(1);
-
-			SusiPortIOGetByte(EC_PMC2_DAT, &fpart);
+	if ((ret = __hwm_find(HWM_FAN, type)) >= 0 &&
+	    sensors [ret].enc == HWM_ENC_NONE)
+		ret = -ENODEV;
 
-			sprintf(str, "%d.%.2d", ipart, fpart);
-			*retval = (flt)atof(str);
-			break;
-		case V33:
-			SusiPortIOSetByte(EC_PMC2_CMD, EC_PMC2_CMD_V33_INT);
-			sleep(1);
+	if (ret < 0 || (ret = __ec_write_data(sensors [ret].duty, setval)) < 0) {
+		susi_err = ret;
+		return 0;
+	}
 
-			SusiPortIOGetByte(EC_PMC2_DAT, &ipart);
+	if (avail)
+		*avail = __hwm_avail(HWM_FAN);
 
-			SusiPortIOSetByte(EC_PMC2_CMD, EC_PMC2_CMD_V33_FLT);
-			sleep(1);
+	return 1;
+}
 
-			SusiPortIOGetByte(EC_PMC2_DAT, &fpart);
+/* Get Temperature sensor data */
+s8 SusiHWMGetTemperature(u16 type, flt *retval, u16 *avail)
+{
+	if (__acquire_pio() < 0)
+		return 0;
 
-			sprintf(str, "%d.%.2d", ipart, fpart);
-			*retval = (flt)atof(str);
-			break;
-		case V50:
-			SusiPortIOSetByte(EC_PMC2_CMD, EC_PMC2_CMD_V50_INT);
-			sleep(1);
+	return __hwm_get(HWM_TEMP, type, retval, avail);
+}
 
-			SusiPortIOGetByte(EC_PMC2_DAT, &ipart);
+/* Get Voltage sensor data */
+s8 SusiHWMGetVoltage(u16 type, flt *retval, u16 *avail)
+{
+	if (__acquire_pio() < 0)
+		return 0;
 
-			SusiPortIOSetByte(EC_PMC2_CMD, EC_PMC2_CMD_V50_FLT);
-			sleep(1);
+	return __hwm_get(HWM_VOLT, type, retval, avail);
+}
 
-			SusiPortIOGetByte(EC_PMC2_DAT, &fpart);
+/* Read any sensor by SUSI_SENSOR_* index - (Internal) */
+s32 __hwm_sample(u32 id, flt *value)
+{
+	s32 ret;
 
-			sprintf(str, "%d.%.2d", ipart, fpart);
-			*retval = (flt)atof(str);
-			break;
-		default:
-			susi_err = -EINVAL;
-			return 0;
-	}
-	
-	if (avail)
-		*avail = VCORE | V33 | V50;
+	if ((ret = __acquire_pio()) < 0)
+		return ret;
 
-	return 1;
+	return __hwm_read(id, value);
 }
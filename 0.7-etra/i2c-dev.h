@@ -170,7 +170,9 @@ static inline __s32 i2c_smbus_access(int file, char read_write, __u8 command,
 	return ioctl(file,I2C_SMBUS,&args);
 }
 
-#define NULL	0
+#ifndef NULL
+#define NULL	((void *)0)
+#endif
 
 static inline __s32 i2c_smbus_write_quick(int file, __u8 value)
 {
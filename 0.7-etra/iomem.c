@@ -6,40 +6,92 @@
  */
 
 #include "susi.h"
+#include "susi_pio.h"
+#include "susi_bsp.h"
 #include <sys/io.h>
 
 /* Globals */
 
-extern int smbus_fd;
+extern __thread int susi_err;
 extern int kernel_fd;
-extern int susi_err;
+extern int bsp_io;
+
+extern s32 __acquire_pio(void);
+extern s32 __acquire_iopl(void);
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* count accesses of width bytes through the kernel helper, to ports [i]
+ * or, if ports is NULL, all to port - (Internal) */
+static s8 __pio_bsp(const u16 *ports, u16 port, u8 width, u8 flags,
+		    void *buf, u32 count)
+{
+	struct bsp_pio p;
+	u32 i, n;
+
+	for (; count; count -= n) {
+		n = count < BSP_PIO_MAX ? count : BSP_PIO_MAX;
+
+		p.count = n;
+		p.width = width;
+		p.flags = flags;
+
+		for (i = 0; i < n; i++) {
+			p.port [i] = ports ? *ports++ : port;
+
+			if (!(flags & BSP_PIO_WRITE))
+				continue;
+
+			switch (width) {
+				case 1: p.value [i] = ((const u8 *)buf) [i]; break;
+				case 2: p.value [i] = ((const u16 *)buf) [i]; break;
+				default: p.value [i] = ((const u32 *)buf) [i]; break;
+			}
+		}
+
+		if (ioctl(kernel_fd, BSP_IOC_PIO, &p) < 0) {
+			susi_err = -errno;
+			return 0;
+		}
+
+		for (i = 0; i < n && !(flags & BSP_PIO_WRITE); i++)
+			switch (width) {
+				case 1: ((u8 *)buf) [i] = p.value [i]; break;
+				case 2: ((u16 *)buf) [i] = p.value [i]; break;
+				default: ((u32 *)buf) [i] = p.value [i]; break;
+			}
+
+		buf = (u8 *)buf + n * width;
+	}
+
+	return 1;
+}
 
 /* -------------------------- External API --------------------------------- */
 
 /* Check if available */
 u8 SusiPortIOAvailable(void)
 {
-	if (smbus_fd >= 0 && kernel_fd >= 0) 
+	if (__acquire_pio() >= 0)
 		return 1;
-	else {
-		susi_err = -EAGAIN;
+	else
 		return -1;
-	}
 }
 
 /* Read byte from port */
 s8 SusiPortIOGetByte(u16 port, u8 *data)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_pio() < 0)
 		return 0;
-	}
 
 	if (!data) {
 		susi_err = -EINVAL;
 		return 0;
 	}
 
+	if (bsp_io)
+		return __pio_bsp(NULL, port, 1, 0, data, 1);
+
 	*data = inb(port);
 	return 1;
 }
@@ -47,16 +99,17 @@ s8 SusiPortIOGetByte(u16 port, u8 *data)
 /* Read short from port */
 s8 SusiPortIOGetWord(u16 port, u16 *data)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_pio() < 0)
 		return 0;
-	}
 
 	if (!data) {
 		susi_err = -EINVAL;
 		return 0;
 	}
 
+	if (bsp_io)
+		return __pio_bsp(NULL, port, 2, 0, data, 1);
+
 	*data = inw(port);
 	return 1;
 }
@@ -64,16 +117,17 @@ s8 SusiPortIOGetWord(u16 port, u16 *data)
 /* Read long from port */
 s8 SusiPortIOGetLong(u16 port, u32 *data)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_pio() < 0)
 		return 0;
-	}
 
 	if (!data) {
 		susi_err = -EINVAL;
 		return 0;
 	}
 
+	if (bsp_io)
+		return __pio_bsp(NULL, port, 4, 0, data, 1);
+
 	*data = inl(port);
 	return 1;
 }
@@ -81,10 +135,11 @@ s8 SusiPortIOGetLong(u16 port, u32 *data)
 /* Out byte to port */
 s8 SusiPortIOSetByte(u16 port, u8 data)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_pio() < 0)
 		return 0;
-	}
+
+	if (bsp_io)
+		return __pio_bsp(NULL, port, 1, BSP_PIO_WRITE, &data, 1);
 
 	outb(data, port);
 	return 1;
@@ -93,10 +148,11 @@ s8 SusiPortIOSetByte(u16 port, u8 data)
 /* Out word to port */
 s8 SusiPortIOSetWord(u16 port, u16 data)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_pio() < 0)
 		return 0;
-	}
+
+	if (bsp_io)
+		return __pio_bsp(NULL, port, 2, BSP_PIO_WRITE, &data, 1);
 
 	outw(data, port);
 	return 1;
@@ -105,12 +161,185 @@ s8 SusiPortIOSetWord(u16 port, u16 data)
 /* Out long to port */
 s8 SusiPortIOSetLong(u16 port, u32 data)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_pio() < 0)
 		return 0;
-	}
+
+	if (bsp_io)
+		return __pio_bsp(NULL, port, 4, BSP_PIO_WRITE, &data, 1);
 
 	outl(data, port);
 	return 1;
 }
 
+
+/* Read byte buffer from port */
+s8 SusiPortIOReadBufByte(u16 port, u8 *buf, u32 count)
+{
+	if (__acquire_pio() < 0)
+		return 0;
+
+	if (!buf) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	if (bsp_io)
+		return __pio_bsp(NULL, port, 1, 0, buf, count);
+
+	insb(port, buf, count);
+	return 1;
+}
+
+/* Read short buffer from port */
+s8 SusiPortIOReadBufWord(u16 port, u16 *buf, u32 count)
+{
+	if (__acquire_pio() < 0)
+		return 0;
+
+	if (!buf) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	if (bsp_io)
+		return __pio_bsp(NULL, port, 2, 0, buf, count);
+
+	insw(port, buf, count);
+	return 1;
+}
+
+/* Read long buffer from port */
+s8 SusiPortIOReadBufLong(u16 port, u32 *buf, u32 count)
+{
+	if (__acquire_pio() < 0)
+		return 0;
+
+	if (!buf) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	if (bsp_io)
+		return __pio_bsp(NULL, port, 4, 0, buf, count);
+
+	insl(port, buf, count);
+	return 1;
+}
+
+/* Out byte buffer to port */
+s8 SusiPortIOWriteBufByte(u16 port, const u8 *buf, u32 count)
+{
+	if (__acquire_pio() < 0)
+		return 0;
+
+	if (!buf) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	if (bsp_io)
+		return __pio_bsp(NULL, port, 1, BSP_PIO_WRITE, (void *)buf, count);
+
+	outsb(port, buf, count);
+	return 1;
+}
+
+/* Out short buffer to port */
+s8 SusiPortIOWriteBufWord(u16 port, const u16 *buf, u32 count)
+{
+	if (__acquire_pio() < 0)
+		return 0;
+
+	if (!buf) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	if (bsp_io)
+		return __pio_bsp(NULL, port, 2, BSP_PIO_WRITE, (void *)buf, count);
+
+	outsw(port, buf, count);
+	return 1;
+}
+
+/* Out long buffer to port */
+s8 SusiPortIOWriteBufLong(u16 port, const u32 *buf, u32 count)
+{
+	if (__acquire_pio() < 0)
+		return 0;
+
+	if (!buf) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	if (bsp_io)
+		return __pio_bsp(NULL, port, 4, BSP_PIO_WRITE, (void *)buf, count);
+
+	outsl(port, buf, count);
+	return 1;
+}
+
+/* Read bytes from a list of ports */
+s8 SusiPortIOGetByteMulti(const u16 *ports, u8 *data, u32 count)
+{
+	u32 i = 0;
+
+	if (__acquire_pio() < 0)
+		return 0;
+
+	if (!ports || !data) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	if (bsp_io)
+		return __pio_bsp(ports, 0, 1, 0, data, count);
+
+	for (; i < count; i++)
+		data [i] = inb(ports [i]);
+
+	return 1;
+}
+
+/* Out bytes to a list of ports */
+s8 SusiPortIOSetByteMulti(const u16 *ports, const u8 *data, u32 count)
+{
+	u32 i = 0;
+
+	if (__acquire_pio() < 0)
+		return 0;
+
+	if (!ports || !data) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	if (bsp_io)
+		return __pio_bsp(ports, 0, 1, BSP_PIO_WRITE, (void *)data, count);
+
+	for (; i < count; i++)
+		outb(data [i], ports [i]);
+
+	return 1;
+}
+
+/* Check port I/O once for the inline API in susi_pio.h; the inline
+ * calls run in the calling thread, so this needs I/O privileges even
+ * where the kernel helper serves the calls above. The token is good
+ * for this thread and threads it creates afterwards */
+s8 SusiPortIOFastInit(SusiPIOToken *token)
+{
+	if (!token) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	token->magic = 0;
+
+	if (__acquire_iopl() < 0)
+		return 0;
+
+	token->magic = SUSI_PIO_MAGIC;
+	return 1;
+}
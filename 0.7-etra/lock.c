@@ -0,0 +1,324 @@
+/* SUSI Library - Cross-process Locking
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ * The EC mailbox and the SMBus adapter are shared by every process
+ * on the box. Each is guarded by a robust, process-shared mutex kept
+ * in a POSIX shared memory segment, and held for a single transaction
+ * only. The segment is open to the owner and the "susi" group only;
+ * one left uninitialized by a creator that died is removed and made
+ * again. Callers refused access get -EACCES rather than running
+ * unarbitrated. Without POSIX shared memory, process-local mutexes are
+ * used instead. Waits for a lock end at the caller's deadline. The
+ * mutexes inherit priority, so a real-time caller waiting on a lock
+ * held by a lower priority thread is not held up by medium priority
+ * work.
+ */
+
+#include "susi.h"
+#include <fcntl.h>
+#include <grp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define LOCK_SHM		"/susi-lock-pi"	/* Apart from pre-PI segments */
+#define LOCK_MAGIC		0x5355534C	/* "SUSL" */
+#define LOCK_GROUP		"susi"		/* May take the locks */
+#define LOCK_MODE		0660
+#define LOCK_INIT_WAIT		1000		/* ms for the creator */
+#define LOCK_ATTEMPTS		3
+
+#define LOCK_EC			0
+#define LOCK_SMBUS		1
+#define LOCK_MAX		2
+
+/* Shared lock page */
+struct lock_page {
+	u32 magic;
+	pthread_mutex_t lock [LOCK_MAX];
+	s32 bus_timeout;		/* Last sent to the SMBus adapter by */
+	s32 bus_retries;		/* any process, -1 = untouched	*/
+};
+
+/* Globals */
+
+static struct lock_page local_page;
+static struct lock_page *page = NULL;	/* Set once, never cleared */
+static pthread_mutex_t page_lock = PTHREAD_MUTEX_INITIALIZER;
+
+extern u64 __now_ns(void);
+extern void __stat_add(u32 id, u64 n);
+
+static const u32 wait_stat [LOCK_MAX] = {
+	SUSI_STAT_LOCK_EC_NS, SUSI_STAT_LOCK_SMBUS_NS
+};
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* Initialize lock page mutexes - (Internal) */
+static void __lock_page_init(struct lock_page *lp, int pshared)
+{
+	pthread_mutexattr_t attr;
+	int i = 0;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+
+	if (pshared)
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+
+	for (; i < LOCK_MAX; i++)
+		pthread_mutex_init(&lp->lock [i], &attr);
+
+	pthread_mutexattr_destroy(&attr);
+
+	lp->bus_timeout = -1;
+	lp->bus_retries = -1;
+
+	__atomic_store_n(&lp->magic, LOCK_MAGIC, __ATOMIC_RELEASE);
+}
+
+/* Restrict the segment to its owner and the SUSI group; not subject
+ * to umask - (Internal) */
+static void __lock_page_perm(int fd)
+{
+	struct group *gr = getgrnam(LOCK_GROUP);
+
+	if (gr && fchown(fd, -1, gr->gr_gid) < 0)
+		debug("%s: chown to %s failed\n", __FUNC__, LOCK_GROUP);
+
+	fchmod(fd, LOCK_MODE);
+}
+
+/* Remove a segment whose creator died before initializing it, unless
+ * it has been replaced meanwhile - (Internal) */
+static void __lock_page_discard(int fd)
+{
+	struct stat st, cur;
+	int cfd;
+
+	if (fstat(fd, &st) < 0 || (cfd = shm_open(LOCK_SHM, O_RDONLY, 0)) < 0)
+		return;
+
+	if (fstat(cfd, &cur) == 0 && cur.st_ino == st.st_ino) {
+		debug("%s: Removing stale lock segment\n", __FUNC__);
+		shm_unlink(LOCK_SHM);
+	}
+
+	close(cfd);
+}
+
+/* Create or attach the shared page; NULL with -EAGAIN if the segment
+ * was stale and has been removed - (Internal) */
+static struct lock_page *__lock_page_open(s32 *err)
+{
+	struct lock_page *lp;
+	struct stat st;
+	int fd, creator = 1, tries = 0;
+
+	fd = shm_open(LOCK_SHM, O_RDWR | O_CREAT | O_EXCL, LOCK_MODE);
+
+	if (fd < 0 && errno == EEXIST) {
+		creator = 0;
+		fd = shm_open(LOCK_SHM, O_RDWR, 0);
+	}
+
+	if (fd < 0) {
+		*err = -errno;
+		return NULL;
+	}
+
+	if (creator) {
+		__lock_page_perm(fd);
+
+		if (ftruncate(fd, sizeof(*lp)) < 0) {
+			*err = -errno;
+			close(fd);
+			shm_unlink(LOCK_SHM);
+			return NULL;
+		}
+	} else {
+		/* Wait for the creator to size the segment */
+		while (fstat(fd, &st) == 0 && st.st_size < sizeof(*lp)) {
+			if (++tries > LOCK_INIT_WAIT) {
+				__lock_page_discard(fd);
+				close(fd);
+				*err = -EAGAIN;
+				return NULL;
+			}
+			usleep(1000);
+		}
+	}
+
+	lp = mmap(NULL, sizeof(*lp), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (lp == MAP_FAILED) {
+		*err = -errno;
+		close(fd);
+		return NULL;
+	}
+
+	if (creator)
+		__lock_page_init(lp, 1);
+	else {
+		/* Wait for the creator to initialize the mutexes */
+		for (tries = 0; __atomic_load_n(&lp->magic, __ATOMIC_ACQUIRE) !=
+		     LOCK_MAGIC; tries++) {
+			if (tries > LOCK_INIT_WAIT) {
+				__lock_page_discard(fd);
+				munmap(lp, sizeof(*lp));
+				close(fd);
+				*err = -EAGAIN;
+				return NULL;
+			}
+			usleep(1000);
+		}
+	}
+
+	close(fd);
+
+	return lp;
+}
+
+/* Map shared lock page, page_lock held; a failure is not kept, the
+ * next lock attempt tries again - (Internal) */
+static s32 __lock_page_map(void)
+{
+	struct lock_page *lp = NULL;
+	s32 err = -EAGAIN;
+	int i = 0;
+
+	/* A stale segment is removed and created afresh */
+	for (; i < LOCK_ATTEMPTS && !lp && err == -EAGAIN; i++)
+		lp = __lock_page_open(&err);
+
+	if (lp) {
+		__atomic_store_n(&page, lp, __ATOMIC_RELEASE);
+		return 0;
+	}
+
+	/* Refused: taking the hardware without arbitration is not an option */
+	if (err == -EACCES || err == -EPERM || err == -EAGAIN) {
+		debug("%s: Lock segment unavailable: %d\n", __FUNC__, err);
+		return err;
+	}
+
+	/* No POSIX shared memory on this system */
+	debug("%s: Using process-local locks\n", __FUNC__);
+	__lock_page_init(&local_page, 0);
+	__atomic_store_n(&page, &local_page, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* Lock page, mapped on first use - (Internal) */
+static s32 __lock_page_get(void)
+{
+	s32 ret = 0;
+
+	if (__atomic_load_n(&page, __ATOMIC_ACQUIRE))
+		return 0;
+
+	pthread_mutex_lock(&page_lock);
+
+	if (!page)
+		ret = __lock_page_map();
+
+	pthread_mutex_unlock(&page_lock);
+
+	return ret;
+}
+
+/* Map the lock page ahead of the first transaction - (Internal) */
+void __lock_prefault(void)
+{
+	__lock_page_get();
+}
+
+/* Take lock by deadline (0 waits forever), recovering it from a dead
+ * owner - (Internal) */
+static s32 __lock(int idx, u64 deadline)
+{
+	struct timespec ts;
+	u64 now, left, start;
+	int ret;
+
+	if ((ret = __lock_page_get()) < 0)
+		return ret;
+
+	/* Uncontended: no clock reads */
+	if ((ret = pthread_mutex_trylock(&page->lock [idx])) != EBUSY)
+		goto locked;
+
+	start = __now_ns();
+
+	if (!deadline)
+		ret = pthread_mutex_lock(&page->lock [idx]);
+	else if ((now = __now_ns()) >= deadline)
+		return -ETIMEDOUT;
+	else {
+		/* Timed locks wait on CLOCK_REALTIME */
+		left = deadline - now;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		left += ts.tv_nsec;
+		ts.tv_sec += left / 1000000000ULL;
+		ts.tv_nsec = left % 1000000000ULL;
+
+		ret = pthread_mutex_timedlock(&page->lock [idx], &ts);
+	}
+
+	__stat_add(SUSI_STAT_LOCK_WAITS, 1);
+	__stat_add(wait_stat [idx], __now_ns() - start);
+
+locked:
+	/* Owner died mid-transaction; the next transaction starts afresh */
+	if (ret == EOWNERDEAD)
+		ret = pthread_mutex_consistent(&page->lock [idx]);
+
+	return -ret;
+}
+
+/* Release lock - (Internal) */
+static void __unlock(int idx)
+{
+	pthread_mutex_unlock(&page->lock [idx]);
+}
+
+/* EC mailbox lock - (Internal) */
+s32 __lock_ec(u64 deadline)
+{
+	return __lock(LOCK_EC, deadline);
+}
+
+void __unlock_ec(void)
+{
+	__unlock(LOCK_EC);
+}
+
+/* SMBus adapter lock - (Internal) */
+s32 __lock_smbus(u64 deadline)
+{
+	return __lock(LOCK_SMBUS, deadline);
+}
+
+void __unlock_smbus(void)
+{
+	__unlock(LOCK_SMBUS);
+}
+
+/* Adapter timeout and retries last set by any process, SMBus lock
+ * held - (Internal) */
+s32 *__lock_smbus_timeout(void)
+{
+	return &page->bus_timeout;
+}
+
+s32 *__lock_smbus_retries(void)
+{
+	return &page->bus_retries;
+}
@@ -0,0 +1,297 @@
+/* SUSI Library - OpenMetrics Exporter
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ * Renders cached sensor, GPIO and watchdog state and the library
+ * counters in OpenMetrics text format. Rendering never touches the
+ * hardware or the heap; the serving loop answers every request on a
+ * Unix socket or localhost TCP port with a fresh rendering.
+ */
+
+#include "susi.h"
+#include <stdarg.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define METRICS_BUF		8192
+#define METRICS_IO_MS		1000	/* Per recv / send on a scrape */
+#define METRICS_CTYPE		"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/* Output cursor */
+struct metrics_out {
+	char *buf;
+	u32 len;
+	u32 pos;
+	int full;
+};
+
+/* Globals */
+
+extern __thread int susi_err;
+
+static const char *sensor_names [SUSI_SENSOR_MAX] = {
+	"tcpu", "tsys", "vcore", "v33", "v50", "fcpu", "fsys"
+};
+
+static const struct {
+	const char *name;
+	const char *help;
+	int seconds;		/* Counter is in ns, export as seconds */
+} stat_names [SUSI_STAT_MAX] = {
+	{ "susi_smbus_transactions", "SMBus transactions", 0 },
+	{ "susi_smbus_errors", "Failed SMBus transactions", 0 },
+	{ "susi_smbus_busy_seconds", "Time spent in SMBus transactions", 1 },
+	{ "susi_ec_transactions", "EC mailbox transactions", 0 },
+	{ "susi_ec_errors", "Failed EC mailbox transactions", 0 },
+	{ "susi_ec_busy_seconds", "Time spent in EC mailbox transactions", 1 },
+	{ "susi_lock_waits", "Contended EC and SMBus lock acquisitions", 0 },
+	{ "susi_ec_lock_wait_seconds", "Time spent waiting for the EC lock", 1 },
+	{ "susi_smbus_lock_wait_seconds", "Time spent waiting for the SMBus lock", 1 },
+};
+
+static int serve_fd = -1;
+static volatile int serving = 0;
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* Append formatted text - (Internal) */
+static void __out(struct metrics_out *out, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (out->full)
+		return;
+
+	va_start(ap, fmt);
+	n = vsnprintf(out->buf + out->pos, out->len - out->pos, fmt, ap);
+	va_end(ap);
+
+	if (n < 0 || n >= out->len - out->pos)
+		out->full = 1;
+	else
+		out->pos += n;
+}
+
+/* Sensor families - (Internal) */
+static void __render_sensors(struct metrics_out *out)
+{
+	flt value;
+	u32 i;
+
+	__out(out, "# TYPE susi_temperature_celsius gauge\n"
+		   "# HELP susi_temperature_celsius Last temperature reading\n");
+
+	for (i = SUSI_SENSOR_TCPU; i <= SUSI_SENSOR_TSYS; i++)
+		if (SusiHWMGetCached(i, &value, NULL))
+			__out(out, "susi_temperature_celsius{sensor=\"%s\"} %.2f\n",
+			      sensor_names [i], value);
+
+	__out(out, "# TYPE susi_voltage_volts gauge\n"
+		   "# HELP susi_voltage_volts Last voltage reading\n");
+
+	for (i = SUSI_SENSOR_VCORE; i <= SUSI_SENSOR_V50; i++)
+		if (SusiHWMGetCached(i, &value, NULL))
+			__out(out, "susi_voltage_volts{rail=\"%s\"} %.2f\n",
+			      sensor_names [i], value);
+
+	__out(out, "# TYPE susi_fan_speed_rpm gauge\n"
+		   "# HELP susi_fan_speed_rpm Last fan speed reading\n");
+
+	for (i = SUSI_SENSOR_FCPU; i <= SUSI_SENSOR_FSYS; i++)
+		if (SusiHWMGetCached(i, &value, NULL))
+			__out(out, "susi_fan_speed_rpm{fan=\"%s\"} %.0f\n",
+			      sensor_names [i], value);
+}
+
+/* GPIO and watchdog families - (Internal) */
+static void __render_state(struct metrics_out *out)
+{
+	u32 known = 0, status = 0, armed = 0, timeout = 0, i;
+
+	__out(out, "# TYPE susi_gpio_level gauge\n"
+		   "# HELP susi_gpio_level Last known user GPIO level\n");
+
+	SusiIOGetCached(&known, &status);
+
+	for (i = 0; i < 8; i++)
+		if (known & (1 << i))
+			__out(out, "susi_gpio_level{pin=\"%u\"} %u\n", i,
+			      (status >> i) & 1);
+
+	SusiWDGetCached(&armed, &timeout, NULL);
+
+	__out(out, "# TYPE susi_watchdog_armed gauge\n"
+		   "# HELP susi_watchdog_armed Watchdog enabled by this process\n"
+		   "susi_watchdog_armed %u\n"
+		   "# TYPE susi_watchdog_timeout_seconds gauge\n"
+		   "# HELP susi_watchdog_timeout_seconds Configured watchdog timeout\n"
+		   "susi_watchdog_timeout_seconds %u.%03u\n",
+	      armed, timeout / 1000, timeout % 1000);
+}
+
+/* Counter families - (Internal) */
+static void __render_stats(struct metrics_out *out)
+{
+	u64 value;
+	u32 i;
+
+	for (i = 0; i < SUSI_STAT_MAX; i++) {
+		SusiGetStat(i, &value);
+
+		__out(out, "# TYPE %s counter\n# HELP %s %s\n", 
+		      stat_names [i].name, stat_names [i].name, 
+		      stat_names [i].help);
+
+		if (stat_names [i].seconds)
+			__out(out, "%s_total %llu.%09llu\n", stat_names [i].name,
+			      value / 1000000000ULL, value % 1000000000ULL);
+		else
+			__out(out, "%s_total %llu\n", stat_names [i].name, value);
+	}
+}
+
+/* Answer one scrape - (Internal) */
+static void __serve_one(int fd)
+{
+	char req [1024], hdr [256], body [METRICS_BUF];
+	struct timeval tv = { METRICS_IO_MS / 1000, (METRICS_IO_MS % 1000) * 1000 };
+	u32 used = 0;
+	int n;
+
+	/* A client that stalls cannot hold up the serving loop */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	/* Request content does not matter, every path gets the metrics */
+	if (recv(fd, req, sizeof(req), 0) <= 0)
+		return;
+
+	if (!SusiMetricsRender(body, sizeof(body), &used)) {
+		n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 500 Internal Server Error\r\n"
+			     "Content-Length: 0\r\n\r\n");
+		send(fd, hdr, n, MSG_NOSIGNAL);
+		return;
+	}
+
+	n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\n"
+		     "Content-Type: " METRICS_CTYPE "\r\n"
+		     "Content-Length: %u\r\n\r\n", used);
+
+	if (send(fd, hdr, n, MSG_NOSIGNAL | MSG_MORE) == n)
+		send(fd, body, used, MSG_NOSIGNAL);
+}
+
+/* -------------------------- External API --------------------------------- */
+
+/* Render metrics into buf, no hardware access or allocation */
+s8 SusiMetricsRender(char *buf, u32 len, u32 *used)
+{
+	struct metrics_out out = { buf, len, 0, 0 };
+
+	if (!buf || !len) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	__render_sensors(&out);
+	__render_state(&out);
+	__render_stats(&out);
+	__out(&out, "# EOF\n");
+
+	if (out.full) {
+		susi_err = -ENOSPC;
+		return 0;
+	}
+
+	if (used)
+		*used = out.pos;
+
+	return 1;
+}
+
+/* Serve metrics on a Unix socket (path) or 127.0.0.1:port until stopped */
+s8 SusiMetricsServe(const char *path, u16 port)
+{
+	struct sockaddr_un uaddr;
+	struct sockaddr_in iaddr;
+	int fd, cfd, one = 1;
+
+	if ((!path && !port) || (path && strlen(path) >= sizeof(uaddr.sun_path))) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	if (path) {
+		memset(&uaddr, 0, sizeof(uaddr));
+		uaddr.sun_family = AF_UNIX;
+		strcpy(uaddr.sun_path, path);
+		unlink(path);
+
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+		    bind(fd, (struct sockaddr *)&uaddr, sizeof(uaddr)) < 0)
+			goto fail;
+	} else {
+		memset(&iaddr, 0, sizeof(iaddr));
+		iaddr.sin_family = AF_INET;
+		iaddr.sin_port = htons(port);
+		iaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+			goto fail;
+
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		if (bind(fd, (struct sockaddr *)&iaddr, sizeof(iaddr)) < 0)
+			goto fail;
+	}
+
+	if (listen(fd, 8) < 0)
+		goto fail;
+
+	serve_fd = fd;
+	serving = 1;
+
+	while (serving) {
+		if ((cfd = accept(fd, NULL, NULL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		__serve_one(cfd);
+		close(cfd);
+	}
+
+	serve_fd = -1;
+	close(fd);
+
+	if (path)
+		unlink(path);
+
+	return 1;
+
+fail:
+	susi_err = -errno;
+	if (fd >= 0)
+		close(fd);
+	return 0;
+}
+
+/* Stop SusiMetricsServe() running in another thread */
+s8 SusiMetricsStop(void)
+{
+	int fd = serve_fd;
+
+	serving = 0;
+
+	/* Wake the blocked accept() */
+	if (fd >= 0)
+		shutdown(fd, SHUT_RDWR);
+
+	return 1;
+}
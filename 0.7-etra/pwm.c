@@ -0,0 +1,342 @@
+/* SUSI Library
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ */
+
+#include "susi.h"
+#include <pthread.h>
+#include <string.h>
+#include <sys/timerfd.h>
+
+/* Timed outputs - software PWM, pulses and blink patterns on the user
+ * output pins. One thread sleeps on a timerfd armed for the earliest
+ * edge; edges due within PWM_SLACK of each other are applied together
+ * with a single register update per F75111 bank. The thread is started
+ * by the first request, idles on the disarmed timer while no channel is
+ * active, and is stopped and joined by the last SusiUnInit. A failed
+ * register write is reported by the next request, which fails with its
+ * error and changes nothing.
+ */
+
+#define PWM_PIN_FIRST		4
+#define PWM_PIN_LAST		7
+#define PWM_BANKS		4	/* Banks 1-3, 0 unused */
+
+#define PWM_SLACK		200000ULL	/* ns */
+#define PWM_NS_PER_MS		1000000ULL
+
+#define PWM_OFF			0
+#define PWM_PWM			1
+#define PWM_BLINK		2
+
+/* Per-pin output channel */
+struct pwm_chan {
+	u32 mode;
+	u64 hi, lo;		/* PWM high / low time, ns */
+	u32 pattern;		/* Blink bits, LSB first */
+	u32 bits, bit;		/* Pattern length, next bit */
+	u64 step;		/* Blink bit time, ns */
+	u32 repeat;		/* Patterns left, 0 forever */
+	u8 level;		/* Current level */
+	u8 final;		/* Level left once a blink ends */
+	u64 next;		/* Next edge, CLOCK_MONOTONIC ns */
+};
+
+/* Globals */
+
+extern __thread int susi_err;
+
+extern u64 __now_ns(void);
+extern s32 __acquire_smbus(void);
+extern s32 __thread_create(pthread_t *tid, void *(*fn)(void *), void *arg);
+extern s32 __gpio_user_map(u8 pin, u8 *bank, u8 *bit);
+extern s32 __write_gpio_bank(u8 bank, u8 mask, u8 value);
+extern void __cache_io(u32 mask, u32 status);
+
+static struct pwm_chan chans [PWM_PIN_LAST + 1];
+static pthread_mutex_t pwm_lock = PTHREAD_MUTEX_INITIALIZER;
+static int pwm_fd = -1;
+static int pwm_running = 0;		/* Set by start and stop only */
+static pthread_t pwm_tid;
+static s32 pwm_err = 0;			/* Last write failure, not reported */
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* Arm the timer for an absolute time, 0 fires at once - (Internal) */
+static void __pwm_arm(u64 when)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+
+	if (!when) {
+		its.it_value.tv_nsec = 1;
+		timerfd_settime(pwm_fd, 0, &its, NULL);
+		return;
+	}
+
+	its.it_value.tv_sec = when / 1000000000ULL;
+	its.it_value.tv_nsec = when % 1000000000ULL;
+	timerfd_settime(pwm_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* Apply a channel's due edge and schedule the next - (Internal) */
+static void __pwm_edge(struct pwm_chan *c)
+{
+	switch (c->mode) {
+		case PWM_PWM:
+			c->level = !c->level;
+			c->next += c->level ? c->hi : c->lo;
+			break;
+		case PWM_BLINK:
+			if (c->bit == c->bits) {
+				c->bit = 0;
+				if (c->repeat && !--c->repeat) {
+					c->level = c->final;
+					c->mode = PWM_OFF;
+					break;
+				}
+			}
+
+			c->level = (c->pattern >> c->bit++) & 1;
+			c->next += c->step;
+			break;
+	}
+}
+
+/* Output thread - (Internal) */
+static void *__pwm_thread(void *arg)
+{
+	u8 mask [PWM_BANKS], value [PWM_BANKS], bank, bit;
+	u32 pin, changed, levels, pins [PWM_BANKS];
+	u64 now, next, ticks;
+	s32 ret;
+
+	pthread_mutex_lock(&pwm_lock);
+
+	while (pwm_running) {
+		memset(mask, 0, sizeof(mask));
+		memset(value, 0, sizeof(value));
+		memset(pins, 0, sizeof(pins));
+		changed = levels = 0;
+		next = 0;
+		now = __now_ns();
+
+		/* Collect every edge due now or within the slack */
+		for (pin = PWM_PIN_FIRST; pin <= PWM_PIN_LAST; pin++) {
+			while (chans [pin].mode != PWM_OFF &&
+			       chans [pin].next <= now + PWM_SLACK) {
+				__pwm_edge(&chans [pin]);
+				changed |= 1 << pin;
+			}
+
+			if (chans [pin].mode != PWM_OFF &&
+			    (!next || chans [pin].next < next))
+				next = chans [pin].next;
+
+			if (!(changed & (1 << pin)) ||
+			    __gpio_user_map(pin, &bank, &bit) < 0)
+				continue;
+
+			mask [bank] |= 1 << bit;
+			pins [bank] |= 1 << pin;
+			if (chans [pin].level) {
+				value [bank] |= 1 << bit;
+				levels |= 1 << pin;
+			}
+		}
+
+		/* Idle on the disarmed timer until the next request */
+		if (next)
+			__pwm_arm(next);
+
+		pthread_mutex_unlock(&pwm_lock);
+
+		/* One register update per bank */
+		for (bank = 1; bank < PWM_BANKS; bank++) {
+			if (!mask [bank] || (ret = __write_gpio_bank(bank, 
+					mask [bank], value [bank])) >= 0)
+				continue;
+
+			debug("%s: bank %d write failed\n", __FUNC__, bank);
+			__atomic_store_n(&pwm_err, ret, __ATOMIC_RELAXED);
+			changed &= ~pins [bank];
+		}
+
+		if (changed)
+			__cache_io(changed, levels & changed);
+
+		if (read(pwm_fd, &ticks, sizeof(ticks)) < 0 && errno != EINTR)
+			debug("%s: timerfd read failed\n", __FUNC__);
+
+		pthread_mutex_lock(&pwm_lock);
+	}
+
+	pthread_mutex_unlock(&pwm_lock);
+
+	return NULL;
+}
+
+/* Install a channel, starting the thread if needed - (Internal) */
+static s8 __pwm_start(u8 pin, const struct pwm_chan *c)
+{
+	s32 ret;
+
+	if (__acquire_smbus() < 0)
+		return 0;
+
+	if (pin < PWM_PIN_FIRST || pin > PWM_PIN_LAST) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	/* Earlier output failed */
+	if ((ret = __atomic_exchange_n(&pwm_err, 0, __ATOMIC_RELAXED)) < 0) {
+		susi_err = ret;
+		return 0;
+	}
+
+	pthread_mutex_lock(&pwm_lock);
+
+	if (pwm_fd < 0 &&
+	    (pwm_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) {
+		susi_err = -errno;
+		pthread_mutex_unlock(&pwm_lock);
+		return 0;
+	}
+
+	if (!pwm_running) {
+		if ((ret = __thread_create(&pwm_tid, __pwm_thread, NULL)) < 0) {
+			susi_err = ret;
+			pthread_mutex_unlock(&pwm_lock);
+			return 0;
+		}
+
+		pwm_running = 1;
+	}
+
+	chans [pin] = *c;
+	chans [pin].next = __now_ns();
+
+	/* Wake the thread to apply the first edge */
+	__pwm_arm(0);
+
+	pthread_mutex_unlock(&pwm_lock);
+
+	return 1;
+}
+
+/* Stop the output thread, pins keep their levels; called by the last
+ * SusiUnInit - (Internal) */
+void __pwm_stop(void)
+{
+	pthread_t tid;
+	u32 pin = 0;
+
+	pthread_mutex_lock(&pwm_lock);
+
+	if (!pwm_running) {
+		pthread_mutex_unlock(&pwm_lock);
+		return;
+	}
+
+	for (; pin <= PWM_PIN_LAST; pin++)
+		chans [pin].mode = PWM_OFF;
+
+	pwm_running = 0;
+	tid = pwm_tid;
+	__pwm_arm(0);
+
+	pthread_mutex_unlock(&pwm_lock);
+
+	pthread_join(tid, NULL);
+
+	pthread_mutex_lock(&pwm_lock);
+	close(pwm_fd);
+	pwm_fd = -1;
+	pwm_err = 0;
+	pthread_mutex_unlock(&pwm_lock);
+}
+
+/* -------------------------- External API --------------------------------- */
+
+/* PWM on an output pin, period in ms, duty 0-100 % */
+s8 SusiIOPWMSet(u8 pin, u32 period, u8 duty)
+{
+	struct pwm_chan c;
+
+	if (!period || duty > 100) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	/* 0 and 100 % are steady levels */
+	if (duty == 0 || duty == 100)
+		return SusiIOPWMStop(pin, duty ? GPIO_HIGH : GPIO_LOW);
+
+	memset(&c, 0, sizeof(c));
+	c.mode = PWM_PWM;
+	c.hi = (u64)period * PWM_NS_PER_MS * duty / 100;
+	c.lo = (u64)period * PWM_NS_PER_MS - c.hi;
+	c.level = GPIO_LOW;	/* First edge raises the pin */
+
+	return __pwm_start(pin, &c);
+}
+
+/* Drive level for width ms, then the opposite level */
+s8 SusiIOPulse(u8 pin, u8 level, u32 width)
+{
+	if ((level != GPIO_LOW && level != GPIO_HIGH) || !width) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	return SusiIOBlink(pin, level, 1, width, 1, !level);
+}
+
+/* Play pattern (bits, LSB first) at step ms per bit, repeat times or
+ * forever if 0, then leave the pin at final */
+s8 SusiIOBlink(u8 pin, u32 pattern, u8 bits, u32 step, u32 repeat, u8 final)
+{
+	struct pwm_chan c;
+
+	if (!bits || bits > 32 || !step ||
+	    (final != GPIO_LOW && final != GPIO_HIGH)) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	memset(&c, 0, sizeof(c));
+	c.mode = PWM_BLINK;
+	c.pattern = pattern;
+	c.bits = bits;
+	c.step = (u64)step * PWM_NS_PER_MS;
+	c.repeat = repeat;
+	c.final = final;
+
+	return __pwm_start(pin, &c);
+}
+
+/* Stop timed output on a pin and leave it at level */
+s8 SusiIOPWMStop(u8 pin, u8 level)
+{
+	struct pwm_chan c;
+
+	if (level != GPIO_LOW && level != GPIO_HIGH) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	/* A one bit pattern played once lands the level on the next edge */
+	memset(&c, 0, sizeof(c));
+	c.mode = PWM_BLINK;
+	c.pattern = level;
+	c.bits = 1;
+	c.step = 0;
+	c.repeat = 1;
+	c.final = level;
+
+	return __pwm_start(pin, &c);
+}
@@ -0,0 +1,268 @@
+/* SUSI Library - Real-time Execution
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ * Every library-owned thread is started through __thread_create and
+ * runs with the scheduling policy, priority and CPU affinity set by
+ * SusiRTSetConfig; a new configuration is also applied to the threads
+ * already running. SusiRTLockMemory locks the process in memory and
+ * faults in the library's state and the caller's stack so that the
+ * real-time subset of calls never takes a page fault.
+ */
+
+#define _GNU_SOURCE
+#include "susi.h"
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#define RT_THREADS_MAX		16
+#define RT_PAGE			4096
+#define RT_STACK_SLACK		65536	/* Stack kept for frames in use */
+
+/* Library thread slot */
+struct rt_thread {
+	int used;
+	pthread_t tid;
+	void *(*fn)(void *);
+	void *arg;
+};
+
+/* Globals */
+
+extern __thread int susi_err;
+
+extern void __lock_prefault(void);
+
+static SusiRTConfig rt_cfg = { SCHED_OTHER, 0, 0 };
+static struct rt_thread threads [RT_THREADS_MAX];
+static pthread_mutex_t rt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* Affinity mask from a CPU bitmap, 0 if any CPU - (Internal) */
+static int __rt_cpuset(u64 cpus, cpu_set_t *set)
+{
+	int i = 0;
+
+	CPU_ZERO(set);
+
+	for (; i < 64; i++)
+		if (cpus & (1ULL << i))
+			CPU_SET(i, set);
+
+	return cpus != 0;
+}
+
+/* Apply the configuration to a running thread, rt_lock held
+ * - (Internal) */
+static s32 __rt_apply(pthread_t tid)
+{
+	struct sched_param sp;
+	cpu_set_t set;
+	int ret;
+
+	sp.sched_priority = rt_cfg.priority;
+
+	if ((ret = pthread_setschedparam(tid, rt_cfg.policy, &sp)))
+		return -ret;
+
+	if (__rt_cpuset(rt_cfg.cpus, &set) &&
+	    (ret = pthread_setaffinity_np(tid, sizeof(set), &set)))
+		return -ret;
+
+	return 0;
+}
+
+/* Thread entry, frees the slot on return - (Internal) */
+static void *__rt_start(void *arg)
+{
+	struct rt_thread *t = arg;
+	void *ret;
+
+	ret = t->fn(t->arg);
+
+	pthread_mutex_lock(&rt_lock);
+	t->used = 0;
+	pthread_mutex_unlock(&rt_lock);
+
+	return ret;
+}
+
+/* Check a stack prefault size fits the stack limit - (Internal) */
+static s32 __rt_stack_ok(u32 size)
+{
+	struct rlimit rl;
+
+	if (!size)
+		return -EINVAL;
+
+	if (getrlimit(RLIMIT_STACK, &rl) < 0)
+		return -errno;
+
+	if (rl.rlim_cur != RLIM_INFINITY &&
+	    (rlim_t)size + RT_STACK_SLACK > rl.rlim_cur)
+		return -EINVAL;
+
+	return 0;
+}
+
+/* Fault in size bytes of the calling thread's stack, size checked by
+ * __rt_stack_ok - (Internal) */
+static void __rt_prefault_stack(u32 size)
+{
+	u8 buf [size];
+	volatile u8 *p = buf;
+	u32 i = 0;
+
+	for (; i < size; i += RT_PAGE)
+		p [i] = 0;
+}
+
+/* Start a library-owned thread - (Internal) */
+s32 __thread_create(pthread_t *tid, void *(*fn)(void *), void *arg)
+{
+	struct rt_thread *t = NULL;
+	struct sched_param sp;
+	pthread_attr_t attr;
+	cpu_set_t set;
+	int i = 0, ret;
+
+	pthread_mutex_lock(&rt_lock);
+
+	for (; i < RT_THREADS_MAX && !t; i++)
+		if (!threads [i].used)
+			t = &threads [i];
+
+	if (!t) {
+		pthread_mutex_unlock(&rt_lock);
+		return -EAGAIN;
+	}
+
+	pthread_attr_init(&attr);
+
+	if (rt_cfg.policy != SCHED_OTHER) {
+		sp.sched_priority = rt_cfg.priority;
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, rt_cfg.policy);
+		pthread_attr_setschedparam(&attr, &sp);
+	}
+
+	if (__rt_cpuset(rt_cfg.cpus, &set))
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+
+	t->fn = fn;
+	t->arg = arg;
+
+	/* The slot is released under rt_lock, so it outlives this call */
+	if (!(ret = pthread_create(&t->tid, &attr, __rt_start, t))) {
+		t->used = 1;
+		*tid = t->tid;
+	}
+
+	pthread_attr_destroy(&attr);
+	pthread_mutex_unlock(&rt_lock);
+
+	return -ret;
+}
+
+/* -------------------------- External API --------------------------------- */
+
+/* Scheduling for library threads, running and future */
+s8 SusiRTSetConfig(const SusiRTConfig *cfg)
+{
+	SusiRTConfig old;
+	s32 ret = 0;
+	int i = 0;
+
+	if (!cfg || (cfg->policy != SCHED_OTHER && cfg->policy != SCHED_FIFO &&
+		     cfg->policy != SCHED_RR) ||
+	    (int)cfg->priority < sched_get_priority_min(cfg->policy) ||
+	    (int)cfg->priority > sched_get_priority_max(cfg->policy)) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&rt_lock);
+
+	old = rt_cfg;
+	rt_cfg = *cfg;
+
+	for (; i < RT_THREADS_MAX && ret == 0; i++)
+		if (threads [i].used)
+			ret = __rt_apply(threads [i].tid);
+
+	/* Refused (privileges, CPUs): back to the old configuration */
+	if (ret < 0) {
+		rt_cfg = old;
+		for (i = 0; i < RT_THREADS_MAX; i++)
+			if (threads [i].used)
+				__rt_apply(threads [i].tid);
+	}
+
+	pthread_mutex_unlock(&rt_lock);
+
+	if (ret < 0) {
+		susi_err = ret;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Scheduling in use for library threads */
+s8 SusiRTGetConfig(SusiRTConfig *cfg)
+{
+	if (!cfg) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&rt_lock);
+	*cfg = rt_cfg;
+	pthread_mutex_unlock(&rt_lock);
+
+	return 1;
+}
+
+/* Lock the process in memory, fault in library state and the first
+ * stack bytes of the calling thread's stack */
+s8 SusiRTLockMemory(u32 stack)
+{
+	s32 ret;
+
+	if ((ret = __rt_stack_ok(stack)) < 0) {
+		susi_err = ret;
+		return 0;
+	}
+
+	/* Keep freed heap mapped, never serve malloc from fresh mmaps */
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	/* Map the shared lock page before locking */
+	__lock_prefault();
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		susi_err = -errno;
+		return 0;
+	}
+
+	__rt_prefault_stack(stack);
+
+	return 1;
+}
+
+/* Undo SusiRTLockMemory */
+s8 SusiRTUnlockMemory(void)
+{
+	if (munlockall() < 0) {
+		susi_err = -errno;
+		return 0;
+	}
+
+	return 1;
+}
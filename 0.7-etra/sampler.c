@@ -0,0 +1,224 @@
+/* SUSI Library - Adaptive Sensor Sampling
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ * A library thread samples each enabled sensor on its own period.
+ * The period halves while the value moves by at least delta per
+ * sample, drops to the minimum near an alarm limit, and grows by
+ * half while the value stays flat, always within [min, max]. Samples
+ * go through the normal read path, so the cache, history and alarms
+ * all see them.
+ */
+
+#include "susi.h"
+#include <pthread.h>
+#include <time.h>
+
+/* Per-sensor schedule */
+struct samp_sensor {
+	u32 min, max;		/* ms, min 0 = disabled */
+	flt delta;
+	u32 period;		/* Current, ms */
+	u64 due;
+	flt last;
+	int primed;
+};
+
+/* Globals */
+
+extern __thread int susi_err;
+
+extern u64 __now_ns(void);
+extern s32 __thread_create(pthread_t *tid, void *(*fn)(void *), void *arg);
+extern s32 __hwm_sample(u32 id, flt *value);
+extern flt __alarm_margin(u32 id, flt value);
+
+static struct samp_sensor samp [SUSI_SENSOR_MAX];
+static pthread_mutex_t samp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t samp_cond;
+static pthread_once_t samp_once = PTHREAD_ONCE_INIT;
+static pthread_t samp_tid;
+static int samp_running = 0;
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* Condition variable on the monotonic clock - (Internal) */
+static void __samp_init(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&samp_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/* Choose the next period after a sample, samp_lock held - (Internal) */
+static void __samp_adapt(struct samp_sensor *s, u32 id, s32 ret, flt value)
+{
+	flt change, margin;
+
+	if (ret < 0) {
+		/* Back off while the sensor fails */
+		s->period = s->max;
+		return;
+	}
+
+	if (s->primed) {
+		change = value > s->last ? value - s->last : s->last - value;
+		margin = __alarm_margin(id, value);
+
+		if (margin >= 0 && margin < 4 * s->delta)
+			s->period = s->min;
+		else if (change >= s->delta)
+			s->period = s->period / 2;
+		else if (change < s->delta / 4)
+			s->period += (s->period + 1) / 2;
+	}
+
+	if (s->period < s->min)
+		s->period = s->min;
+	if (s->period > s->max)
+		s->period = s->max;
+
+	s->last = value;
+	s->primed = 1;
+}
+
+/* Sampler thread - (Internal) */
+static void *__samp_thread(void *arg)
+{
+	struct timespec ts;
+	u64 now, due;
+	flt value = 0;
+	s32 ret;
+	u32 i, id;
+
+	pthread_mutex_lock(&samp_lock);
+
+	while (samp_running) {
+		/* Earliest due sensor */
+		id = SUSI_SENSOR_MAX;
+		for (i = 0; i < SUSI_SENSOR_MAX; i++)
+			if (samp [i].min && (id == SUSI_SENSOR_MAX || 
+			    samp [i].due < samp [id].due))
+				id = i;
+
+		if (id == SUSI_SENSOR_MAX) {
+			pthread_cond_wait(&samp_cond, &samp_lock);
+			continue;
+		}
+
+		now = __now_ns();
+		due = samp [id].due;
+
+		if (due > now) {
+			ts.tv_sec = due / 1000000000ULL;
+			ts.tv_nsec = due % 1000000000ULL;
+			pthread_cond_timedwait(&samp_cond, &samp_lock, &ts);
+			continue;
+		}
+
+		pthread_mutex_unlock(&samp_lock);
+		ret = __hwm_sample(id, &value);
+		pthread_mutex_lock(&samp_lock);
+
+		/* Reconfigured or disabled while sampling */
+		if (!samp [id].min || samp [id].due != due)
+			continue;
+
+		__samp_adapt(&samp [id], id, ret, value);
+		samp [id].due = __now_ns() + samp [id].period * 1000000ULL;
+	}
+
+	pthread_mutex_unlock(&samp_lock);
+
+	return NULL;
+}
+
+/* -------------------------- External API --------------------------------- */
+
+/* Sample sensor every min..max ms, delta is a significant change */
+s8 SusiHWMSamplerConfig(u32 sensor, u32 min, u32 max, flt delta)
+{
+	if (sensor >= SUSI_SENSOR_MAX || (min && (max < min || delta <= 0))) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	pthread_once(&samp_once, __samp_init);
+
+	pthread_mutex_lock(&samp_lock);
+
+	samp [sensor].min = min;
+	samp [sensor].max = max;
+	samp [sensor].delta = delta;
+	samp [sensor].period = min;
+	samp [sensor].due = __now_ns();
+	samp [sensor].primed = 0;
+
+	pthread_cond_signal(&samp_cond);
+	pthread_mutex_unlock(&samp_lock);
+
+	return 1;
+}
+
+/* Current sampling period of a sensor */
+s8 SusiHWMSamplerGetPeriod(u32 sensor, u32 *period)
+{
+	if (sensor >= SUSI_SENSOR_MAX || !period) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&samp_lock);
+	*period = samp [sensor].min ? samp [sensor].period : 0;
+	pthread_mutex_unlock(&samp_lock);
+
+	return 1;
+}
+
+/* Start the sampler thread */
+s8 SusiHWMSamplerStart(void)
+{
+	s32 ret;
+
+	pthread_once(&samp_once, __samp_init);
+
+	pthread_mutex_lock(&samp_lock);
+
+	if (!samp_running) {
+		samp_running = 1;
+
+		if ((ret = __thread_create(&samp_tid, __samp_thread, NULL)) < 0) {
+			samp_running = 0;
+			pthread_mutex_unlock(&samp_lock);
+			susi_err = ret;
+			return 0;
+		}
+	}
+
+	pthread_mutex_unlock(&samp_lock);
+
+	return 1;
+}
+
+/* Stop the sampler thread */
+s8 SusiHWMSamplerStop(void)
+{
+	pthread_mutex_lock(&samp_lock);
+
+	if (!samp_running) {
+		pthread_mutex_unlock(&samp_lock);
+		return 1;
+	}
+
+	samp_running = 0;
+	pthread_cond_signal(&samp_cond);
+	pthread_mutex_unlock(&samp_lock);
+
+	pthread_join(samp_tid, NULL);
+
+	return 1;
+}
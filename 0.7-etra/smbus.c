@@ -8,47 +8,343 @@
 #include <linux/ioctl.h>
 #include "i2c-dev.h"
 #include "susi.h"
+#include <string.h>
 
+#define SMBUS_TIMEOUT_MS	1000	/* Adapter default (HZ) */
+#define SMBUS_RDWR_MAX		42	/* Kernel limit of msgs per I2C_RDWR */
 /* Globals */
 
 extern int smbus_fd;
 extern int kernel_fd;
-extern int susi_err;
+extern __thread int susi_err;
+
+extern s32 __acquire_smbus(void);
+extern s32 __lock_smbus(u64 deadline);
+extern u64 __deadline(u64 fallback);
+extern u32 __retries(void);
+extern s32 __wc_write(u8 address, u8 reg, u8 value);
+extern s32 __wc_read(u8 address, u8 reg, u8 *value);
+extern s32 __wc_flush(void);
+extern void __unlock_smbus(void);
+extern s32 *__lock_smbus_timeout(void);
+extern s32 *__lock_smbus_retries(void);
+extern u64 __now_ns(void);
+extern void __stat_add(u32 id, u64 n);
+
+static int i2c_funcs = -1;
+
+/* Bus hold of this thread */
+static __thread u64 hold_start = 0;
+static __thread u64 hold_deadline = 0;
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* Set adapter timeout (10 ms units) from the remaining time, and
+ * retries, for threads that asked for them. Both are adapter-wide, so
+ * the values last sent by any process are kept in the lock page:
+ * unchanged ones are not sent again, and a timeout some process
+ * shortened goes back to the default for unbounded callers. The
+ * adapter's own retry count is left alone unless a thread sets one.
+ * Smbus lock held - (Internal) */
+static s32 __smbus_bound(u64 deadline)
+{
+	s32 *bus_timeout = __lock_smbus_timeout();
+	s32 *bus_retries = __lock_smbus_retries();
+	u64 now = __now_ns();
+	long timeout = SMBUS_TIMEOUT_MS / 10;
+	long retries = __retries();
+
+	if (deadline) {
+		if (now >= deadline)
+			return -ETIMEDOUT;
+
+		timeout = (deadline - now + 9999999ULL) / 10000000ULL;
+	}
+
+	if ((deadline || *bus_timeout >= 0) && timeout != *bus_timeout) {
+		if (ioctl(smbus_fd, I2C_TIMEOUT, timeout) < 0)
+			return -errno;
+		*bus_timeout = timeout;
+	}
+
+	if (retries && retries != *bus_retries) {
+		if (ioctl(smbus_fd, I2C_RETRIES, retries) < 0)
+			return -errno;
+		*bus_retries = retries;
+	}
+
+	return 0;
+}
+
+/* Run one SMBus transaction under the bus lock - (Internal) */
+static s32 __smbus_access(u8 address, char rw, u8 command, int size,
+			  union i2c_smbus_data *data)
+{
+	u64 start, deadline = __deadline(0);
+	s32 ret;
+
+	/* Combined writes go out first */
+	if ((ret = __wc_flush()) < 0)
+		return ret;
+
+	if ((ret = __lock_smbus(deadline)) < 0)
+		return ret;
+
+	start = __now_ns();
+
+	/* Set bounds and device address */
+	if ((ret = __smbus_bound(deadline)) == 0) {
+		if (ioctl(smbus_fd, I2C_SLAVE, address >> 1) < 0)
+			ret = -errno;
+		else if (i2c_smbus_access(smbus_fd, rw, command, size, data) < 0)
+			ret = -errno;
+	}
+
+	/* Adapters report a timeout as EAGAIN or ETIMEDOUT */
+	if (ret == -EAGAIN && deadline && __now_ns() >= deadline)
+		ret = -ETIMEDOUT;
+
+	__stat_add(SUSI_STAT_SMBUS_NS, __now_ns() - start);
+	__unlock_smbus();
+
+	__stat_add(SUSI_STAT_SMBUS_XFERS, 1);
+	if (ret < 0)
+		__stat_add(SUSI_STAT_SMBUS_ERRORS, 1);
+
+	return ret;
+}
+
+/* Adapter does plain I2C, so I2C_RDWR works - (Internal) */
+static int __smbus_has_rdwr(void)
+{
+	unsigned long funcs = 0;
+
+	if (i2c_funcs < 0)
+		i2c_funcs = ioctl(smbus_fd, I2C_FUNCS, &funcs) < 0 ? 0 : 
+			    (funcs & I2C_FUNC_I2C) != 0;
+
+	return i2c_funcs;
+}
+
+/* Run a list through I2C_RDWR, as few ioctls as the msg limit allows;
+ * a failed ioctl fails all ops it carried - (Internal) */
+static s32 __smbus_rdwr(SusiSMBusXfer *ops, u32 count)
+{
+	struct i2c_msg msgs [SMBUS_RDWR_MAX];
+	struct i2c_rdwr_ioctl_data rdwr;
+	u8 wbuf [SMBUS_RDWR_MAX][SUSI_XFER_MAX + 1];
+	u32 i = 0, first, n;
+	s32 ret = 0;
+
+	while (i < count) {
+		first = i;
+
+		for (n = 0; i < count; i++) {
+			SusiSMBusXfer *op = &ops [i];
+
+			if (n + (op->flags & SUSI_XFER_READ ? 2 : 1) > SMBUS_RDWR_MAX)
+				break;
+
+			msgs [n].addr = op->address >> 1;
+			msgs [n].flags = 0;
+
+			if (op->flags & SUSI_XFER_READ) {
+				/* Register write, repeated start, read */
+				msgs [n].len = 1;
+				msgs [n].buf = (char *)&op->cmd;
+				n++;
+
+				msgs [n].addr = op->address >> 1;
+				msgs [n].flags = I2C_M_RD;
+				msgs [n].len = op->len;
+				msgs [n].buf = (char *)op->data;
+			} else {
+				wbuf [n][0] = op->cmd;
+				memcpy(&wbuf [n][1], op->data, op->len);
+
+				msgs [n].len = op->len + 1;
+				msgs [n].buf = (char *)wbuf [n];
+			}
+			n++;
+		}
+
+		rdwr.msgs = msgs;
+		rdwr.nmsgs = n;
+
+		ret = ioctl(smbus_fd, I2C_RDWR, &rdwr) < 0 ? -errno : 0;
+
+		for (; first < i; first++)
+			ops [first].result = ret;
+
+		if (ret < 0)
+			break;
+	}
+
+	return ret;
+}
+
+/* Run a list as SMBus transfers, stopping at the first failure - 
+ * (Internal) */
+static s32 __smbus_each(SusiSMBusXfer *ops, u32 count)
+{
+	union i2c_smbus_data data;
+	int address = -1;
+	char rw;
+	u32 i = 0;
+	s32 ret = 0;
+
+	for (; i < count; i++) {
+		SusiSMBusXfer *op = &ops [i];
+
+		if (ret < 0) {
+			op->result = -ECANCELED;
+			continue;
+		}
+
+		rw = op->flags & SUSI_XFER_READ ? I2C_SMBUS_READ : I2C_SMBUS_WRITE;
+
+		/* Readdress only when the device changes */
+		if (op->address != address) {
+			if (ioctl(smbus_fd, I2C_SLAVE, op->address >> 1) < 0) {
+				ret = op->result = -errno;
+				continue;
+			}
+			address = op->address;
+		}
+
+		if (op->len == 1) {
+			data.byte = op->data [0];
+			ret = i2c_smbus_access(smbus_fd, rw, op->cmd, 
+					       I2C_SMBUS_BYTE_DATA, &data);
+			if (ret >= 0 && rw == I2C_SMBUS_READ)
+				op->data [0] = data.byte;
+		} else {
+			data.block [0] = op->len;
+			memcpy(&data.block [1], op->data, op->len);
+			ret = i2c_smbus_access(smbus_fd, rw, op->cmd, 
+					       I2C_SMBUS_I2C_BLOCK_DATA, &data);
+			if (ret >= 0 && rw == I2C_SMBUS_READ)
+				memcpy(op->data, &data.block [1], op->len);
+		}
+
+		ret = op->result = ret < 0 ? -errno : 0;
+	}
+
+	return ret;
+}
+
+/* Drop the bus lock taken by __smbus_hold - (Internal) */
+void __smbus_release(void)
+{
+	__stat_add(SUSI_STAT_SMBUS_NS, __now_ns() - hold_start);
+	__unlock_smbus();
+}
+
+/* Take the bus lock and set this thread's bounds - (Internal) */
+static s32 __smbus_enter(void)
+{
+	s32 ret;
+
+	hold_deadline = __deadline(0);
+
+	if ((ret = __lock_smbus(hold_deadline)) < 0)
+		return ret;
+
+	hold_start = __now_ns();
+
+	if ((ret = __smbus_bound(hold_deadline)) < 0) {
+		__smbus_release();
+		__stat_add(SUSI_STAT_SMBUS_ERRORS, 1);
+	}
+
+	return ret;
+}
+
+/* Take the bus lock for several lists run back to back, e.g. a read
+ * and the write depending on it; combined writes go out first. 
+ * __smbus_release ends the hold - (Internal) */
+s32 __smbus_hold(void)
+{
+	s32 ret;
+
+	if ((ret = __wc_flush()) < 0)
+		return ret;
+
+	return __smbus_enter();
+}
+
+/* Run a transaction list, bus lock held - (Internal) */
+s32 __smbus_run_held(SusiSMBusXfer *ops, u32 count)
+{
+	u32 i = 0;
+	s32 ret;
+
+	for (; i < count; i++)
+		if (!ops [i].len || ops [i].len > SUSI_XFER_MAX)
+			return -EINVAL;
+
+	ret = __smbus_has_rdwr() ? __smbus_rdwr(ops, count) :
+				   __smbus_each(ops, count);
+
+	if (ret == -EAGAIN && hold_deadline && __now_ns() >= hold_deadline)
+		ret = -ETIMEDOUT;
+
+	__stat_add(SUSI_STAT_SMBUS_XFERS, count);
+	if (ret < 0)
+		__stat_add(SUSI_STAT_SMBUS_ERRORS, 1);
+
+	return ret;
+}
+
+/* Run a transaction list under one hold of the bus lock, bypassing
+ * write combining - (Internal) */
+s32 __smbus_run(SusiSMBusXfer *ops, u32 count)
+{
+	s32 ret;
+
+	if ((ret = __smbus_enter()) < 0)
+		return ret;
+
+	ret = __smbus_run_held(ops, count);
+	__smbus_release();
+
+	return ret;
+}
+
+/* Run a transaction list after any combined writes - (Internal) */
+s32 __smbus_xfer(SusiSMBusXfer *ops, u32 count)
+{
+	s32 ret;
+
+	if ((ret = __wc_flush()) < 0)
+		return ret;
+
+	return __smbus_run(ops, count);
+}
 
 /* -------------------------- External API --------------------------------- */
 
 /* Check if SMBus is available */
 u8 SusiSMBusAvailable(void)
 {
-	if (smbus_fd >= 0 && kernel_fd >= 0) 
+	if (__acquire_smbus() >= 0)
 		return 1;
-	else {
-		susi_err = -EAGAIN;
+	else
 		return -1;
-	}
 }
 
 /* Quick Write */
 s8 SusiSMBusWriteQuick(u8 address)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
 	u8 bval = address & 0x01;
 
 	debug("%s: Setting slave address: 0x%x\n", __FUNC__, address);
 
-	/* Set device address */
-	if ((susi_err = ioctl(smbus_fd, I2C_SLAVE, address >> 1)) < 0)
-		return 0;
-
 	/* Quick cmd */
-	susi_err = i2c_smbus_write_quick(smbus_fd, bval);
-
-	if (susi_err < 0)
-		susi_err = -errno;
+	susi_err = __smbus_access(address, bval, 0, I2C_SMBUS_QUICK, NULL);
 
 	debug("%s: Returned %d\n", __FUNC__, susi_err);
 
@@ -64,10 +360,10 @@ s8 SusiSMBusReadQuick(u8 address)
 /* Receive Byte */
 s8 SusiSMBusReceiveByte(u8 address, u8 *value)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	union i2c_smbus_data data;
+
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
 	if (!value) {
 		susi_err = -EINVAL;
@@ -76,20 +372,13 @@ s8 SusiSMBusReceiveByte(u8 address, u8 *value)
 
 	debug("%s: Setting slave address: 0x%x\n", __FUNC__, address);
 
-	/* Set device address */
-	if ((susi_err = ioctl(smbus_fd, I2C_SLAVE, address >> 1)) < 0)
-		return 0;
-
 	/* Read byte */
-	susi_err = i2c_smbus_read_byte(smbus_fd);
-
-	if (susi_err < 0)
-		susi_err = -errno;
+	susi_err = __smbus_access(address, I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE, &data);
 
 	debug("%s: Returned %d\n", __FUNC__, susi_err);
 
 	if (susi_err >= 0)
-		*value = (u8)susi_err;
+		*value = data.byte;
 
 	return susi_err >= 0 ? 1 : 0;
 }
@@ -97,22 +386,14 @@ s8 SusiSMBusReceiveByte(u8 address, u8 *value)
 /* Send Byte */
 s8 SusiSMBusSendByte(u8 address, u8 value)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
 	debug("%s: Setting slave address: 0x%x\n", __FUNC__, address);
 
-	/* Set device address */
-	if ((susi_err = ioctl(smbus_fd, I2C_SLAVE, address >> 1)) < 0)
-		return 0;
-
 	/* Write byte */
-	susi_err = i2c_smbus_write_byte(smbus_fd, value);
-
-	if (susi_err < 0)
-		susi_err = -errno;
+	susi_err = __smbus_access(address, I2C_SMBUS_WRITE, value,
+				  I2C_SMBUS_BYTE, NULL);
 
 	debug("%s: Returned %d\n", __FUNC__, susi_err);
 
@@ -122,32 +403,30 @@ s8 SusiSMBusSendByte(u8 address, u8 value)
 /* Read Byte */
 s8 SusiSMBusReadByte(u8 address, u8 offset, u8 *value)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	union i2c_smbus_data data;
+
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
 	if (!value) {
 		susi_err = -EINVAL;
 		return 0;
 	}
 
-	debug("%s: Setting slave address: 0x%x\n", __FUNC__, address);
+	/* Pending combined write */
+	if (__wc_read(address, offset, value))
+		return 1;
 
-	/* Set device address */
-	if ((susi_err = ioctl(smbus_fd, I2C_SLAVE, address >> 1)) < 0)
-		return 0;
+	debug("%s: Setting slave address: 0x%x\n", __FUNC__, address);
 
 	/* Read byte data */
-	susi_err = i2c_smbus_read_byte_data(smbus_fd, offset);
-
-	if (susi_err < 0)
-		susi_err = -errno;
+	susi_err = __smbus_access(address, I2C_SMBUS_READ, offset,
+				  I2C_SMBUS_BYTE_DATA, &data);
 
 	debug("%s: Returned %d\n", __FUNC__, susi_err);
 
 	if (susi_err >= 0)
-		*value = (u8)susi_err;
+		*value = data.byte;
 
 	return susi_err >= 0 ? 1 : 0;
 }
@@ -155,22 +434,27 @@ s8 SusiSMBusReadByte(u8 address, u8 offset, u8 *value)
 /* Write Byte */
 s8 SusiSMBusWriteByte(u8 address, u8 offset, u8 value)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	union i2c_smbus_data data;
+	s32 ret;
+
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
-	debug("%s: Setting slave address: 0x%x\n", __FUNC__, address);
+	/* Queued when write combining is on */
+	if ((ret = __wc_write(address, offset, value)) > 0)
+		return 1;
 
-	/* Set device address */
-	if ((susi_err = ioctl(smbus_fd, I2C_SLAVE, address >> 1)) < 0)
+	if (ret < 0) {
+		susi_err = ret;
 		return 0;
+	}
 
-	/* Write byte data */
-	susi_err = i2c_smbus_write_byte_data(smbus_fd, offset, value);
+	debug("%s: Setting slave address: 0x%x\n", __FUNC__, address);
 
-	if (susi_err < 0)
-		susi_err = -errno;
+	/* Write byte data */
+	data.byte = value;
+	susi_err = __smbus_access(address, I2C_SMBUS_WRITE, offset,
+				  I2C_SMBUS_BYTE_DATA, &data);
 
 	debug("%s: Returned %d\n", __FUNC__, susi_err);
 
@@ -180,10 +464,10 @@ s8 SusiSMBusWriteByte(u8 address, u8 offset, u8 value)
 /* Read Word */
 s8 SusiSMBusReadWord(u8 address, u8 offset, u16 *value)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	union i2c_smbus_data data;
+
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
 	if (!value) {
 		susi_err = -EINVAL;
@@ -192,20 +476,14 @@ s8 SusiSMBusReadWord(u8 address, u8 offset, u16 *value)
 
 	debug("%s: Setting slave address: 0x%x\n", __FUNC__, address);
 
-	/* Set device address */
-	if ((susi_err = ioctl(smbus_fd, I2C_SLAVE, address >> 1)) < 0)
-		return 0;
-
 	/* Read word data */
-	susi_err = i2c_smbus_read_word_data(smbus_fd, offset);
-
-	if (susi_err < 0)
-		susi_err = -errno;
+	susi_err = __smbus_access(address, I2C_SMBUS_READ, offset,
+				  I2C_SMBUS_WORD_DATA, &data);
 
 	debug("%s: Returned %d\n", __FUNC__, susi_err);
 
 	if (susi_err >= 0)
-		*value = (u16)susi_err;
+		*value = data.word;
 
 	return susi_err >= 0 ? 1 : 0;
 }
@@ -213,22 +491,17 @@ s8 SusiSMBusReadWord(u8 address, u8 offset, u16 *value)
 /* Write Word */
 s8 SusiSMBusWriteWord(u8 address, u8 offset, u16 value)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	union i2c_smbus_data data;
+
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
 	debug("%s: Setting slave address: 0x%x\n", __FUNC__, address);
 
-	/* Set device address */
-	if ((susi_err = ioctl(smbus_fd, I2C_SLAVE, address >> 1)) < 0)
-		return 0;
-
 	/* Write word data */
-	susi_err = i2c_smbus_write_word_data(smbus_fd, offset, value);
-
-	if (susi_err < 0)
-		susi_err = -errno;
+	data.word = value;
+	susi_err = __smbus_access(address, I2C_SMBUS_WRITE, offset,
+				  I2C_SMBUS_WORD_DATA, &data);
 
 	debug("%s: Returned %d\n", __FUNC__, susi_err);
 
@@ -241,3 +514,22 @@ s8 SusiSMBusScanDevice(u8 address)
 	susi_err = -ENODEV;
 	return 0;	
 }
+
+/* Run a list of register reads / writes as one transaction; result
+ * holds each op's outcome */
+s8 SusiSMBusTransfer(SusiSMBusXfer *ops, u32 count)
+{
+	if (__acquire_smbus() < 0)
+		return 0;
+
+	if (!ops || !count) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	susi_err = __smbus_xfer(ops, count);
+
+	debug("%s: Returned %d\n", __FUNC__, susi_err);
+
+	return susi_err >= 0 ? 1 : 0;
+}
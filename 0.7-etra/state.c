@@ -0,0 +1,333 @@
+/* SUSI Library - Broker Client
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ * Readers map the state page published by susid and copy values out
+ * of it without locks or system calls. Writes are sent to susid over
+ * its Unix socket so that only the broker touches the hardware.
+ */
+
+#include "susi.h"
+#include "susi_state.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define STATE_SPIN_MAX		100000	/* Reads of an odd seq before giving up */
+
+/* Globals */
+
+extern __thread int susi_err;
+
+static const struct susi_state *state = NULL;
+static int sock_fd = -1;
+static pthread_mutex_t sock_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* Consistent copy of the state page - (Internal) */
+static s32 __state_snapshot(struct susi_state *snap)
+{
+	u32 seq, spin = 0;
+
+	if (!state)
+		return -EAGAIN;
+
+	/* A broker that died mid-update leaves seq odd for good */
+	do {
+		while ((seq = __atomic_load_n(&state->seq, __ATOMIC_ACQUIRE)) & 1)
+			if (++spin >= STATE_SPIN_MAX)
+				return -EAGAIN;
+
+		memcpy(snap, (const void *)state, sizeof(*snap));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&state->seq, __ATOMIC_RELAXED) != seq);
+
+	return 0;
+}
+
+/* Send a command to susid and wait for the result - (Internal) */
+static s32 __state_cmd(u32 cmd, u32 arg0, u32 arg1)
+{
+	struct susi_state_cmd req = { cmd, { arg0, arg1 } };
+	struct susi_state_rsp rsp = { -EIO };
+	struct sockaddr_un addr;
+	s32 ret = 0;
+
+	pthread_mutex_lock(&sock_lock);
+
+	if (sock_fd < 0) {
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, STATE_SOCK, sizeof(addr.sun_path) - 1);
+
+		if ((sock_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0)
+			ret = -errno;
+		else if (connect(sock_fd, (struct sockaddr *)&addr, 
+				 sizeof(addr)) < 0) {
+			ret = -errno;
+			close(sock_fd);
+			sock_fd = -1;
+		}
+	}
+
+	if (!ret) {
+		if (send(sock_fd, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req) ||
+		    recv(sock_fd, &rsp, sizeof(rsp), 0) != sizeof(rsp)) {
+			/* Broker went away, reconnect next time */
+			ret = -ECONNRESET;
+			close(sock_fd);
+			sock_fd = -1;
+		} else
+			ret = rsp.err;
+	}
+
+	pthread_mutex_unlock(&sock_lock);
+
+	return ret;
+}
+
+/* Run a broker command, API return convention - (Internal) */
+static s8 __state_cmd_api(u32 cmd, u32 arg0, u32 arg1)
+{
+	s32 ret = __state_cmd(cmd, arg0, arg1);
+
+	if (ret < 0) {
+		susi_err = ret;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* -------------------------- External API --------------------------------- */
+
+/* Map the broker state page */
+s8 SusiStateAttach(void)
+{
+	struct susi_state *sp;
+	struct stat st;
+	int fd;
+
+	if (state) {
+		susi_err = -EEXIST;
+		return 0;
+	}
+
+	if ((fd = shm_open(STATE_SHM, O_RDONLY, 0)) < 0) {
+		susi_err = -errno;
+		return 0;
+	}
+
+	/* Only a page made by root (susid) or by ourselves is trusted */
+	if (fstat(fd, &st) < 0 || (st.st_uid != 0 && st.st_uid != geteuid())) {
+		close(fd);
+		susi_err = -EPERM;
+		return 0;
+	}
+
+	sp = mmap(NULL, sizeof(*sp), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (sp == MAP_FAILED) {
+		susi_err = -errno;
+		return 0;
+	}
+
+	if (sp->magic != STATE_MAGIC || sp->version != STATE_VERSION) {
+		munmap(sp, sizeof(*sp));
+		susi_err = -EPROTO;
+		return 0;
+	}
+
+	state = sp;
+	return 1;
+}
+
+/* Unmap the state page and drop the broker connection */
+s8 SusiStateDetach(void)
+{
+	if (state)
+		munmap((void *)state, sizeof(*state));
+
+	state = NULL;
+
+	pthread_mutex_lock(&sock_lock);
+
+	if (sock_fd >= 0)
+		close(sock_fd);
+
+	sock_fd = -1;
+
+	pthread_mutex_unlock(&sock_lock);
+
+	return 1;
+}
+
+/* Cached temperature */
+s8 SusiStateGetTemperature(u16 type, flt *retval)
+{
+	struct susi_state snap;
+	u32 flag;
+	s32 ret;
+
+	if (!retval) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	switch (type) {
+		case TCPU:
+			flag = STATE_TCPU;
+			break;
+		case TSYS:
+			flag = STATE_TSYS;
+			break;
+		default:
+			susi_err = -EINVAL;
+			return 0;
+	}
+
+	if ((ret = __state_snapshot(&snap)) < 0) {
+		susi_err = ret;
+		return 0;
+	}
+
+	if (!(snap.valid & flag)) {
+		susi_err = -ENODATA;
+		return 0;
+	}
+
+	*retval = snap.temp [type == TCPU ? 0 : 1];
+	return 1;
+}
+
+/* Cached voltage */
+s8 SusiStateGetVoltage(u16 type, flt *retval)
+{
+	struct susi_state snap;
+	u32 flag, idx;
+	s32 ret;
+
+	if (!retval) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	switch (type) {
+		case VCORE:
+			flag = STATE_VCORE;
+			idx = 0;
+			break;
+		case V33:
+			flag = STATE_V33;
+			idx = 1;
+			break;
+		case V50:
+			flag = STATE_V50;
+			idx = 2;
+			break;
+		default:
+			susi_err = -EINVAL;
+			return 0;
+	}
+
+	if ((ret = __state_snapshot(&snap)) < 0) {
+		susi_err = ret;
+		return 0;
+	}
+
+	if (!(snap.valid & flag)) {
+		susi_err = -ENODATA;
+		return 0;
+	}
+
+	*retval = snap.volt [idx];
+	return 1;
+}
+
+/* Cached GPIO levels */
+s8 SusiStateReadIO(u32 targetmask, u32 *statusmask)
+{
+	struct susi_state snap;
+	s32 ret;
+
+	if (!statusmask) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	if ((ret = __state_snapshot(&snap)) < 0) {
+		susi_err = ret;
+		return 0;
+	}
+
+	if (!(snap.valid & STATE_IO)) {
+		susi_err = -ENODATA;
+		return 0;
+	}
+
+	*statusmask = snap.io_status & targetmask;
+	return 1;
+}
+
+/* Time of the last refresh, CLOCK_MONOTONIC ns */
+s8 SusiStateGetStamp(u64 *stamp)
+{
+	struct susi_state snap;
+	s32 ret;
+
+	if (!stamp) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	if ((ret = __state_snapshot(&snap)) < 0) {
+		susi_err = ret;
+		return 0;
+	}
+
+	*stamp = snap.stamp;
+	return 1;
+}
+
+/* Write GPIOs through the broker */
+s8 SusiBrokerIOWrite(u32 targetmask, u32 statusmask)
+{
+	return __state_cmd_api(STATE_CMD_IO_WRITE, targetmask, statusmask);
+}
+
+/* Set GPIO direction through the broker */
+s8 SusiBrokerIOSetDirection(u8 pin, u8 dir)
+{
+	return __state_cmd_api(STATE_CMD_IO_DIR, pin, dir);
+}
+
+/* Start watchdog through the broker, delay at most 1000 ms */
+s8 SusiBrokerWDSetConfig(u32 delay, u32 timeout)
+{
+	return __state_cmd_api(STATE_CMD_WD_CONFIG, delay, timeout);
+}
+
+/* Kick watchdog through the broker */
+s8 SusiBrokerWDTrigger(void)
+{
+	return __state_cmd_api(STATE_CMD_WD_TRIGGER, 0, 0);
+}
+
+/* Disable watchdog through the broker */
+s8 SusiBrokerWDDisable(void)
+{
+	return __state_cmd_api(STATE_CMD_WD_DISABLE, 0, 0);
+}
+
+/* USB hub control through the broker */
+s8 SusiBrokerUSBHubCtrl(u8 enable)
+{
+	return __state_cmd_api(STATE_CMD_USB_HUB, enable, 0);
+}
@@ -6,6 +6,7 @@
  */
 
 #include "susi.h"
+#include "susi_bsp.h"
 #include <fcntl.h>
 #include <pthread.h>
 #include <sys/io.h>
@@ -15,14 +16,174 @@
 
 #define GPIO_USB		0xA
 
-extern s8 __set_gpio_direction(u8 pin, u8 dir);
-extern s8 __write_gpio(u8 pin, u8 status);
+extern s32 __set_gpio_direction(u8 pin, u8 dir);
+extern s32 __write_gpio(u8 pin, u8 status);
+extern s32 __gpio_txn_stage(u8 gpio, s32 dir, s32 level);
 
 /* Globals */
 
 int kernel_fd = -1;
 int smbus_fd = -1;
-int susi_err = 0;
+__thread int susi_err = 0;	/* Per thread, see SusiGetLastError */
+int bsp_io = 0;			/* EC / port I/O via the kernel helper */
+
+static int susi_init = 0;		/* SusiInit references */
+static int susi_stopping = 0;		/* Last SusiUnInit in progress */
+static int pio_ok = 0;			/* EC / port I/O path chosen */
+static __thread int iopl_ok = 0;	/* iopl is per thread */
+static int bsp_allow = 0;		/* SusiBSPEnable, helper may be used */
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t init_cond = PTHREAD_COND_INITIALIZER;
+
+/* Per-thread bounds on SMBus / EC transactions */
+static __thread u32 call_timeout = 0;	/* ms, 0 = none */
+static __thread u32 call_retries = 0;
+static __thread u64 call_deadline = 0;	/* CLOCK_MONOTONIC ns, 0 = none */
+
+extern u64 __now_ns(void);
+extern s32 __wc_flush(void);
+extern void __pwm_stop(void);
+extern s32 __wc_stop(void);
+
+/* -------------------------- Internal API --------------------------------- */
+
+/* Open kernel helper, init_lock held - (Internal) */
+static s32 __acquire_kernel(void)
+{
+	if (kernel_fd >= 0)
+		return 0;
+
+	if ((kernel_fd = open(DEV_FILE, O_RDWR)) < 0)
+		return -errno;
+
+	return 0;
+}
+
+/* Open SMBus adapter on first use - (Internal) */
+s32 __acquire_smbus(void)
+{
+	s32 ret = 0;
+	int fd;
+
+	if (__atomic_load_n(&smbus_fd, __ATOMIC_ACQUIRE) >= 0)
+		return 0;
+
+	pthread_mutex_lock(&init_lock);
+
+	if (!susi_init)
+		ret = -EAGAIN;
+	else if (smbus_fd < 0 && (ret = __acquire_kernel()) == 0) {
+		if ((fd = open(SMBUS_FILE, O_RDONLY)) < 0)
+			ret = -errno;
+		else
+			__atomic_store_n(&smbus_fd, fd, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&init_lock);
+
+	if (ret < 0)
+		susi_err = ret;
+
+	return ret;
+}
+
+/* Check the kernel helper serves EC and port I/O, init_lock held
+ * - (Internal) */
+static int __bsp_probe(void)
+{
+	u32 version = 0;
+
+	if (__acquire_kernel() < 0)
+		return 0;
+
+	return ioctl(kernel_fd, BSP_IOC_VERSION, &version) == 0 &&
+	       version >= BSP_ABI_VERSION;
+}
+
+/* Request I/O privileges for the calling thread; iopl covers only it
+ * and the threads it creates afterwards - (Internal) */
+static s32 __acquire_iopl_thread(void)
+{
+	if (iopl_ok)
+		return 0;
+
+	if (iopl(3) < 0)
+		return -errno;
+
+	iopl_ok = 1;
+	return 0;
+}
+
+/* EC and port I/O on first use: the kernel helper if enabled and it
+ * has the ioctls, userspace port I/O otherwise - (Internal) */
+s32 __acquire_pio(void)
+{
+	s32 ret = 0;
+
+	if (__atomic_load_n(&pio_ok, __ATOMIC_ACQUIRE)) {
+		if (!bsp_io && (ret = __acquire_iopl_thread()) < 0)
+			susi_err = ret;
+
+		return ret;
+	}
+
+	pthread_mutex_lock(&init_lock);
+
+	if (!susi_init)
+		ret = -EAGAIN;
+	else if (!pio_ok) {
+		if (bsp_allow && __bsp_probe())
+			bsp_io = 1;
+		else
+			ret = __acquire_iopl_thread();
+
+		if (ret == 0)
+			__atomic_store_n(&pio_ok, 1, __ATOMIC_RELEASE);
+	} else if (!bsp_io)
+		ret = __acquire_iopl_thread();
+
+	pthread_mutex_unlock(&init_lock);
+
+	if (ret < 0)
+		susi_err = ret;
+
+	return ret;
+}
+
+/* Port I/O from the calling thread, for the inline calls in
+ * susi_pio.h - (Internal) */
+s32 __acquire_iopl(void)
+{
+	s32 ret;
+
+	pthread_mutex_lock(&init_lock);
+	ret = susi_init ? __acquire_iopl_thread() : -EAGAIN;
+	pthread_mutex_unlock(&init_lock);
+
+	if (ret < 0)
+		susi_err = ret;
+
+	return ret;
+}
+
+/* Deadline for a transaction starting now, 0 if unbounded; fallback
+ * (ns) applies when the thread set no timeout - (Internal) */
+u64 __deadline(u64 fallback)
+{
+	u64 limit = call_timeout ? call_timeout * 1000000ULL : fallback;
+	u64 deadline = call_deadline;
+
+	if (limit && (!deadline || __now_ns() + limit < deadline))
+		deadline = __now_ns() + limit;
+
+	return deadline;
+}
+
+/* SMBus retries for this thread - (Internal) */
+u32 __retries(void)
+{
+	return call_retries;
+}
 
 /* -------------------------- External API --------------------------------- */
 
@@ -35,52 +196,122 @@ void SusiGetVersion(u16 *major, u16 *minor)
 		*minor = SUSI_LIB_VER_MR;
 }
 
-/* Initialization */
+/* Initialization - subsystems are acquired on first use and shared by
+ * every user in the process; each SusiInit needs a matching SusiUnInit */
 s8 SusiInit(void)
 {
 	susi_err = 0;
 
-	if (kernel_fd >= 0 || smbus_fd >= 0) {
-		susi_err = -EEXIST;
-		return 0;
-	}
+	pthread_mutex_lock(&init_lock);
 
-	/* Open kernel helper */
-	if ((kernel_fd = open(DEV_FILE, O_RDWR)) < 0) {
-		susi_err = -errno;
-		return 0;
-	}
+	/* A last SusiUnInit is closing the devices */
+	while (susi_stopping)
+		pthread_cond_wait(&init_cond, &init_lock);
+
+	susi_init++;
+	pthread_mutex_unlock(&init_lock);
+
+	return 1;
+}
 
-	/* Open SMBus adapter */
-	if ((smbus_fd = open(SMBUS_FILE, O_RDONLY)) < 0) {
-		susi_err = -errno;
+/* De-init - the last reference stops the library threads and closes
+ * the devices */
+s8 SusiUnInit(void)
+{
+	/* Combined writes still pending */
+	__wc_flush();
+
+	pthread_mutex_lock(&init_lock);
+
+	if (!susi_init) {
+		pthread_mutex_unlock(&init_lock);
+		susi_err = -EINVAL;
 		return 0;
 	}
 
-	/* Request I/O Privileges */
-	if (iopl(3) < 0) {
-		SusiUnInit();	
-		susi_err = -errno;
-		return 0;
+	susi_err = 0;
+
+	if (--susi_init) {
+		pthread_mutex_unlock(&init_lock);
+		return 1;
 	}
 
+	susi_stopping = 1;
+	pthread_mutex_unlock(&init_lock);
+
+	/* Library threads end before the devices close; they may take
+	 * init_lock, so not under it */
+	SusiHWMSamplerStop();
+	__pwm_stop();
+	__wc_stop();
+
+	pthread_mutex_lock(&init_lock);
+
+	if (kernel_fd >= 0)
+		close(kernel_fd);
+	if (smbus_fd >= 0)
+		close(smbus_fd);
+
+	kernel_fd = -1;
+	smbus_fd = -1;
+	pio_ok = 0;
+	bsp_io = 0;
+
+	susi_stopping = 0;
+	pthread_cond_broadcast(&init_cond);
+	pthread_mutex_unlock(&init_lock);
+
 	return 1;
 }
 
-/* De-init */
-s8 SusiUnInit(void)
+/* Bound each SMBus / EC transaction of this thread to timeout ms, 0
+ * restores the defaults; retries applies to SMBus transfers */
+s8 SusiSetTimeout(u32 timeout, u32 retries)
 {
-	close(kernel_fd);
-	close(smbus_fd);
+	call_timeout = timeout;
+	call_retries = retries;
 
-	kernel_fd = -1;
-	smbus_fd = -1;
-	susi_err = 0;
+	return 1;
+}
+
+/* Fail transactions of this thread with -ETIMEDOUT past deadline
+ * (CLOCK_MONOTONIC ns), 0 clears it */
+s8 SusiSetDeadline(u64 deadline)
+{
+	call_deadline = deadline;
 
 	return 1;
 }
 
-/* Last Error */
+/* Route EC and port I/O through the /dev/bsp helper's ioctls; off by
+ * default, and only before the first EC or port access */
+s8 SusiBSPEnable(u8 enable)
+{
+	s32 ret = 0;
+
+	if (enable != 0 && enable != 1) {
+		susi_err = -EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&init_lock);
+
+	if (pio_ok)
+		ret = -EBUSY;
+	else
+		bsp_allow = enable;
+
+	pthread_mutex_unlock(&init_lock);
+
+	if (ret < 0) {
+		susi_err = ret;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Last error of a failed call made by the calling thread */
 s32 SusiGetLastError(void)
 {
 	return susi_err;
@@ -89,10 +320,8 @@ s32 SusiGetLastError(void)
 /* Misc API */
 s8 SusiUSBHubCtrl(u8 enable)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_smbus() < 0)
 		return 0;
-	}
 
 	if (enable != 0 && enable != 1) {
 		susi_err = -EINVAL;
@@ -100,19 +329,32 @@ s8 SusiUSBHubCtrl(u8 enable)
 	}
 
 	if (enable) {
-		if (__set_gpio_direction(GPIO_USB, GPIO_OUTPUT) < 0)
-			return 0;
-
-		if (__write_gpio(GPIO_USB, GPIO_HIGH) < 0)
+		if ((susi_err = __set_gpio_direction(GPIO_USB, GPIO_OUTPUT)) < 0 ||
+		    (susi_err = __write_gpio(GPIO_USB, GPIO_HIGH)) < 0)
 			return 0;
 	} else {
-		if (__write_gpio(GPIO_USB, GPIO_LOW) < 0)
+		if ((susi_err = __write_gpio(GPIO_USB, GPIO_LOW)) < 0 ||
+		    (susi_err = __set_gpio_direction(GPIO_USB, GPIO_INPUT)) < 0)
 			return 0;
+	}
 
-		if (__set_gpio_direction(GPIO_USB, GPIO_INPUT) < 0)
-			return 0;
+	return 1;
+}
+
+/* Stage USB hub switch in the current GPIO transaction */
+s8 SusiIOTxnUSBHubCtrl(u8 enable)
+{
+	if (enable != 0 && enable != 1) {
+		susi_err = -EINVAL;
+		return 0;
 	}
 
+	/* Commit orders the level before the direction change */
+	if ((susi_err = __gpio_txn_stage(GPIO_USB,
+			enable ? GPIO_OUTPUT : GPIO_INPUT, 
+			enable ? GPIO_HIGH : GPIO_LOW)) < 0)
+		return 0;
+
 	return 1;
 }
 
@@ -45,6 +45,40 @@
 #define VN120			(1 << 8)
 #define VTT			(1 << 9)
 
+/* Sensor Indices (cached readings, history) */
+#define SUSI_SENSOR_TCPU	0
+#define SUSI_SENSOR_TSYS	1
+#define SUSI_SENSOR_VCORE	2
+#define SUSI_SENSOR_V33		3
+#define SUSI_SENSOR_V50		4
+#define SUSI_SENSOR_FCPU	5
+#define SUSI_SENSOR_FSYS	6
+#define SUSI_SENSOR_MAX		7
+
+/* History Resolutions */
+#define SUSI_HIST_RAW		0	/* Individual samples	*/
+#define SUSI_HIST_1S		1
+#define SUSI_HIST_1M		2
+#define SUSI_HIST_1H		3
+#define SUSI_HIST_MAX		4
+
+/* Alarm Kinds */
+#define SUSI_ALARM_HIGH		(1 << 0)
+#define SUSI_ALARM_LOW		(1 << 1)
+#define SUSI_ALARM_RATE		(1 << 2)
+
+/* Performance Counters */
+#define SUSI_STAT_SMBUS_XFERS	0	/* SMBus transactions		*/
+#define SUSI_STAT_SMBUS_ERRORS	1	/* Failed SMBus transactions	*/
+#define SUSI_STAT_SMBUS_NS	2	/* Time spent in SMBus, ns	*/
+#define SUSI_STAT_EC_XFERS	3	/* EC mailbox transactions	*/
+#define SUSI_STAT_EC_ERRORS	4	/* Failed EC transactions	*/
+#define SUSI_STAT_EC_NS		5	/* Time spent in EC, ns		*/
+#define SUSI_STAT_LOCK_WAITS	6	/* Contended EC / SMBus locks	*/
+#define SUSI_STAT_LOCK_EC_NS	7	/* Waiting for the EC lock, ns	*/
+#define SUSI_STAT_LOCK_SMBUS_NS	8	/* Waiting for SMBus lock, ns	*/
+#define SUSI_STAT_MAX		9
+
 #define DEBUG 			0
 
 #if (DEBUG == 1)
@@ -62,9 +96,72 @@ typedef signed short	s16;
 typedef unsigned short	u16;
 typedef signed int	s32;
 typedef unsigned int	u32;
+typedef unsigned long long u64;
 typedef float		flt;
 typedef void *		ptr;
 
+/* SMBus transaction list entry: read or write len bytes at register
+ * cmd of the device at address (8 bit, as in the SMBus API) */
+#define SUSI_XFER_READ		0x01
+#define SUSI_XFER_WRITE		0x00
+#define SUSI_XFER_MAX		32
+
+typedef struct {
+	u8 address;
+	u8 flags;		/* SUSI_XFER_READ / WRITE */
+	u8 cmd;
+	u8 len;			/* 1 - SUSI_XFER_MAX */
+	u8 data [SUSI_XFER_MAX];
+	s32 result;		/* 0 or -errno */
+} SusiSMBusXfer;
+
+/* EC mailbox calibration: command to output-ready latency over
+ * samples probe reads, and the wait phases chosen from it */
+typedef struct {
+	u32 samples;		/* 0 = not calibrated, defaults in use */
+	u32 min;		/* ns */
+	u32 median;
+	u32 p90;
+	u32 max;
+	u32 spin;		/* Busy-poll up to, ns */
+	u32 yield;		/* Then yield up to, ns */
+	u32 sleep;		/* Then sleep steps of, us */
+} SusiECCalibration;
+
+/* Sensor history bucket, start is CLOCK_MONOTONIC ns */
+typedef struct {
+	u64 start;
+	flt min;
+	flt max;
+	flt avg;
+	u32 count;
+} SusiHWMBucket;
+
+/* Sensor alarm limits; hyst applies to high/low, rate is units/s */
+typedef struct {
+	u32 flags;		/* SUSI_ALARM_* enabled */
+	flt high;
+	flt low;
+	flt hyst;
+	flt rate;
+} SusiAlarmConfig;
+
+/* Alarm transition */
+typedef struct {
+	u32 sensor;
+	u32 alarm;		/* SUSI_ALARM_* */
+	u32 active;		/* 1 raised, 0 cleared */
+	flt value;
+	u64 stamp;
+} SusiAlarmEvent;
+
+/* Scheduling of library-created threads */
+typedef struct {
+	u32 policy;		/* SCHED_OTHER, SCHED_FIFO or SCHED_RR */
+	u32 priority;		/* 0 for SCHED_OTHER */
+	u64 cpus;		/* Affinity, bit n = CPU n, 0 = any */
+} SusiRTConfig;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -75,6 +172,9 @@ void SusiGetVersion(u16 *major, u16 *minor);
 s8 SusiUnInit(void);
 s8 SusiInit(void);
 s32 SusiGetLastError(void);
+s8 SusiSetTimeout(u32 timeout, u32 retries);
+s8 SusiSetDeadline(u64 deadline);
+s8 SusiBSPEnable(u8 enable);
 
 /* SMBus API */
 u8 SusiSMBusAvailable(void);
@@ -88,6 +188,9 @@ s8 SusiSMBusWriteByte(u8 address, u8 offset, u8 value);
 s8 SusiSMBusReadWord(u8 address, u8 offset, u16 *value);
 s8 SusiSMBusWriteWord(u8 address, u8 offset, u16 value);
 s8 SusiSMBusScanDevice(u8 address);
+s8 SusiSMBusTransfer(SusiSMBusXfer *ops, u32 count);
+s8 SusiSMBusCombine(u8 enable, u32 window);
+s8 SusiSMBusFlush(void);
 
 /* GPIO API */
 u8 SusiIOAvailable(void);
@@ -101,6 +204,21 @@ s8 SusiIOReadMultiEx(u32 targetmask, u32 *statusmask);
 s8 SusiIOWriteEx(u8 pin, u8 status);
 s8 SusiIOWriteMultiEx(u32 targetmask, u32 statusmask);
 
+/* Timed GPIO output API - output pins only, times in ms */
+s8 SusiIOPWMSet(u8 pin, u32 period, u8 duty);
+s8 SusiIOPulse(u8 pin, u8 level, u32 width);
+s8 SusiIOBlink(u8 pin, u32 pattern, u8 bits, u32 step, u32 repeat, u8 final);
+s8 SusiIOPWMStop(u8 pin, u8 level);
+
+/* Staged GPIO API - per thread, applied as one register update per bank */
+s8 SusiIOTxnBegin(void);
+s8 SusiIOTxnSetDirection(u8 pin, u8 dir);
+s8 SusiIOTxnWrite(u8 pin, u8 status);
+s8 SusiIOTxnWriteMulti(u32 targetmask, u32 statusmask);
+s8 SusiIOTxnUSBHubCtrl(u8 enable);
+s8 SusiIOTxnCommit(void);
+s8 SusiIOTxnAbort(void);
+
 /* Hardware Monitoring API */
 u8 SusiHWMAvailable(void);
 s8 SusiHWMGetFanSpeed(u16 type, u16 *retval, u16 *avail);
@@ -108,6 +226,23 @@ s8 SusiHWMSetFanSpeed(u16 type, u8 setval, u16 *avail);
 s8 SusiHWMGetTemperature(u16 type, flt *retval, u16 *avail);
 s8 SusiHWMGetVoltage(u16 type, flt *retval, u16 *avail);
 
+/* Sensor History API - samples taken by this process, see SUSI_HIST_* */
+s8 SusiHWMHistoryGet(u32 sensor, u32 res, SusiHWMBucket *buf, u32 max,
+		     u32 *count);
+s8 SusiHWMHistoryWindow(u32 sensor, u32 res, u32 n, SusiHWMBucket *out);
+
+/* Adaptive Sampler API - background sampling within [min, max] ms */
+s8 SusiHWMSamplerConfig(u32 sensor, u32 min, u32 max, flt delta);
+s8 SusiHWMSamplerGetPeriod(u32 sensor, u32 *period);
+s8 SusiHWMSamplerStart(void);
+s8 SusiHWMSamplerStop(void);
+
+/* Alarm API - evaluated on every reading, signalled on an eventfd */
+s8 SusiAlarmSet(u32 sensor, const SusiAlarmConfig *cfg);
+s8 SusiAlarmQuery(u32 sensor, u32 *active);
+s8 SusiAlarmGetFd(int *fd);
+s8 SusiAlarmRead(SusiAlarmEvent *buf, u32 max, u32 *count, u32 *lost);
+
 /* Watchdog API */
 u8 SusiWDAvailable(void);
 s8 SusiWDGetRange(u32 *min, u32* max, u32* step);
@@ -115,6 +250,10 @@ s8 SusiWDSetConfig(u32 delay, u32 timeout);
 s8 SusiWDTrigger(void);
 s8 SusiWDDisable(void);
 
+/* EC Mailbox API - wait tuning, defaults until SusiECCalibrate */
+s8 SusiECCalibrate(void);
+s8 SusiECGetCalibration(SusiECCalibration *cal);
+
 /* Port I/O API */
 u8 SusiPortIOAvailable(void);
 s8 SusiPortIOGetByte(u16 port, u8 *data);
@@ -124,6 +263,53 @@ s8 SusiPortIOSetByte(u16 port, u8 data);
 s8 SusiPortIOSetWord(u16 port, u16 data);
 s8 SusiPortIOSetLong(u16 port, u32 data);
 
+/* Port I/O string transfers: count items to/from a single port */
+s8 SusiPortIOReadBufByte(u16 port, u8 *buf, u32 count);
+s8 SusiPortIOReadBufWord(u16 port, u16 *buf, u32 count);
+s8 SusiPortIOReadBufLong(u16 port, u32 *buf, u32 count);
+s8 SusiPortIOWriteBufByte(u16 port, const u8 *buf, u32 count);
+s8 SusiPortIOWriteBufWord(u16 port, const u16 *buf, u32 count);
+s8 SusiPortIOWriteBufLong(u16 port, const u32 *buf, u32 count);
+
+/* Port I/O scatter/gather: data [i] to/from ports [i] */
+s8 SusiPortIOGetByteMulti(const u16 *ports, u8 *data, u32 count);
+s8 SusiPortIOSetByteMulti(const u16 *ports, const u8 *data, u32 count);
+
+/* Broker state API - cached values published by susid */
+s8 SusiStateAttach(void);
+s8 SusiStateDetach(void);
+s8 SusiStateGetTemperature(u16 type, flt *retval);
+s8 SusiStateGetVoltage(u16 type, flt *retval);
+s8 SusiStateReadIO(u32 targetmask, u32 *statusmask);
+s8 SusiStateGetStamp(u64 *stamp);
+
+/* Broker command API - hardware writes performed by susid */
+s8 SusiBrokerIOWrite(u32 targetmask, u32 statusmask);
+s8 SusiBrokerIOSetDirection(u8 pin, u8 dir);
+s8 SusiBrokerWDSetConfig(u32 delay, u32 timeout);
+s8 SusiBrokerWDTrigger(void);
+s8 SusiBrokerWDDisable(void);
+s8 SusiBrokerUSBHubCtrl(u8 enable);
+
+/* Cache API - last values seen by this process, no hardware access */
+s8 SusiHWMGetCached(u32 sensor, flt *retval, u64 *stamp);
+s8 SusiIOGetCached(u32 *knownmask, u32 *statusmask);
+s8 SusiWDGetCached(u32 *armed, u32 *timeout, u64 *trigger);
+s8 SusiGetStat(u32 id, u64 *value);
+
+/* Real-time API - SusiHWMGetCached, SusiIOGetCached, SusiWDGetCached,
+ * SusiGetStat and SusiGetLastError never allocate, block or enter the
+ * kernel and may be called from real-time threads */
+s8 SusiRTSetConfig(const SusiRTConfig *cfg);
+s8 SusiRTGetConfig(SusiRTConfig *cfg);
+s8 SusiRTLockMemory(u32 stack);
+s8 SusiRTUnlockMemory(void);
+
+/* Metrics API - OpenMetrics text from cached values */
+s8 SusiMetricsRender(char *buf, u32 len, u32 *used);
+s8 SusiMetricsServe(const char *path, u16 port);
+s8 SusiMetricsStop(void);
+
 /* Misc API */
 s8 SusiUSBHubCtrl(u8 enable);
 s8 SusiVCAvailable(void);
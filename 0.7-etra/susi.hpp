@@ -0,0 +1,286 @@
+/* SUSI Library - C++ Binding
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ * Header-only C++17 wrapper over susi.h. Every call is an inline
+ * forward to the C function; failures come back in the result rather
+ * than through SusiGetLastError.
+ */
+
+#ifndef __SUSI_HPP__
+#define __SUSI_HPP__
+
+#include "susi.h"
+
+#include <cstdlib>
+#include <utility>
+
+namespace susi {
+
+/* Result of a call: a value or a negative errno */
+template <typename T>
+class result {
+public:
+	constexpr result(T value) : val_(value), err_(0) {}
+
+	static constexpr result failure(s32 err) { return result(T(), err); }
+
+	constexpr bool ok() const { return err_ == 0; }
+	constexpr explicit operator bool() const { return ok(); }
+	constexpr s32 error() const { return err_; }
+
+	/* Value, abort() on failure */
+	constexpr const T &value() const
+	{
+		if (!ok())
+			std::abort();
+		return val_;
+	}
+
+	constexpr const T &operator*() const { return val_; }
+	constexpr T value_or(T dflt) const { return ok() ? val_ : dflt; }
+
+private:
+	constexpr result(T value, s32 err) : val_(value), err_(err) {}
+
+	T val_;
+	s32 err_;
+};
+
+template <>
+class result<void> {
+public:
+	constexpr result() : err_(0) {}
+
+	static constexpr result failure(s32 err) { return result(err); }
+
+	constexpr bool ok() const { return err_ == 0; }
+	constexpr explicit operator bool() const { return ok(); }
+	constexpr s32 error() const { return err_; }
+
+private:
+	constexpr explicit result(s32 err) : err_(err) {}
+
+	s32 err_;
+};
+
+namespace detail {
+
+/* C calls return 1 on success, the error is the calling thread's */
+inline result<void> check(s8 ret)
+{
+	return ret == 1 ? result<void>() :
+			  result<void>::failure(SusiGetLastError());
+}
+
+template <typename T>
+inline result<T> check(s8 ret, T value)
+{
+	return ret == 1 ? result<T>(value) :
+			  result<T>::failure(SusiGetLastError());
+}
+
+} /* namespace detail */
+
+/* User GPIO pins, inputs first */
+enum class pin : u8 {
+	di0 = 0, di1, di2, di3,
+	do0 = 4, do1, do2, do3,
+};
+
+enum class level : u8 {
+	low = GPIO_LOW,
+	high = GPIO_HIGH,
+};
+
+enum class temp : u16 {
+	cpu = TCPU,
+	sys = TSYS,
+};
+
+enum class volt : u16 {
+	core = VCORE,
+	v33 = V33,
+	v50 = V50,
+};
+
+enum class fan : u16 {
+	cpu = FCPU,
+	sys = FSYS,
+};
+
+/* Cached reading indices */
+enum class sensor : u32 {
+	tcpu = SUSI_SENSOR_TCPU,
+	tsys = SUSI_SENSOR_TSYS,
+	vcore = SUSI_SENSOR_VCORE,
+	v33 = SUSI_SENSOR_V33,
+	v50 = SUSI_SENSOR_V50,
+	fcpu = SUSI_SENSOR_FCPU,
+	fsys = SUSI_SENSOR_FSYS,
+};
+
+/* Pin set as used by the multi-pin calls */
+class pin_mask {
+public:
+	constexpr pin_mask() : bits_(0) {}
+	constexpr pin_mask(pin p) : bits_(1u << static_cast<u8>(p)) {}
+
+	static constexpr pin_mask from_bits(u32 bits) { return pin_mask(bits); }
+
+	constexpr u32 bits() const { return bits_; }
+	constexpr bool has(pin p) const { return bits_ & pin_mask(p).bits_; }
+
+	constexpr pin_mask operator|(pin_mask o) const { return pin_mask(bits_ | o.bits_); }
+	constexpr pin_mask operator&(pin_mask o) const { return pin_mask(bits_ & o.bits_); }
+	constexpr bool operator==(pin_mask o) const { return bits_ == o.bits_; }
+	constexpr bool operator!=(pin_mask o) const { return bits_ != o.bits_; }
+
+private:
+	constexpr explicit pin_mask(u32 bits) : bits_(bits) {}
+
+	u32 bits_;
+};
+
+constexpr pin_mask operator|(pin a, pin b) { return pin_mask(a) | pin_mask(b); }
+
+/* Compile-time mask of a pin list */
+template <pin... P>
+constexpr pin_mask mask = (pin_mask() | ... | pin_mask(P));
+
+constexpr pin_mask inputs = mask<pin::di0, pin::di1, pin::di2, pin::di3>;
+constexpr pin_mask outputs = mask<pin::do0, pin::do1, pin::do2, pin::do3>;
+
+/* Library session, SusiInit / SusiUnInit; sessions nest */
+class session {
+public:
+	session() : err_(SusiInit() == 1 ? 0 : SusiGetLastError()) {}
+	~session() { if (!err_) SusiUnInit(); }
+
+	session(const session &) = delete;
+	session &operator=(const session &) = delete;
+
+	session(session &&o) noexcept : err_(std::exchange(o.err_, -EINVAL)) {}
+
+	bool ok() const { return err_ == 0; }
+	explicit operator bool() const { return ok(); }
+	s32 error() const { return err_; }
+
+private:
+	s32 err_;
+};
+
+/* GPIO */
+
+inline result<level> read(pin p)
+{
+	u8 status = 0;
+	s8 ret = SusiIOReadEx(static_cast<u8>(p), &status);
+
+	return detail::check(ret, status ? level::high : level::low);
+}
+
+inline result<void> write(pin p, level l)
+{
+	return detail::check(SusiIOWriteEx(static_cast<u8>(p),
+					   static_cast<u8>(l)));
+}
+
+/* Levels of the pins in m, high pins set in the returned mask */
+inline result<pin_mask> read(pin_mask m)
+{
+	u32 status = 0;
+	s8 ret = SusiIOReadMultiEx(m.bits(), &status);
+
+	return detail::check(ret, pin_mask::from_bits(status));
+}
+
+/* Drive the pins in m, high where set in high */
+inline result<void> write(pin_mask m, pin_mask high)
+{
+	return detail::check(SusiIOWriteMultiEx(m.bits(), high.bits()));
+}
+
+/* Hardware monitor */
+
+inline result<flt> read(temp t)
+{
+	flt value = 0;
+	s8 ret = SusiHWMGetTemperature(static_cast<u16>(t), &value, NULL);
+
+	return detail::check(ret, value);
+}
+
+inline result<flt> read(volt v)
+{
+	flt value = 0;
+	s8 ret = SusiHWMGetVoltage(static_cast<u16>(v), &value, NULL);
+
+	return detail::check(ret, value);
+}
+
+/* Fan speed, RPM */
+inline result<u16> read(fan f)
+{
+	u16 rpm = 0;
+	s8 ret = SusiHWMGetFanSpeed(static_cast<u16>(f), &rpm, NULL);
+
+	return detail::check(ret, rpm);
+}
+
+/* Fan duty, 0-100 % */
+inline result<void> set_duty(fan f, u8 duty)
+{
+	return detail::check(SusiHWMSetFanSpeed(static_cast<u16>(f), duty, NULL));
+}
+
+/* Last value this process read, no hardware access */
+inline result<flt> cached(sensor s, u64 *stamp = NULL)
+{
+	flt value = 0;
+	s8 ret = SusiHWMGetCached(static_cast<u32>(s), &value, stamp);
+
+	return detail::check(ret, value);
+}
+
+/* Watchdog, times in ms */
+
+inline result<void> wd_start(u32 delay, u32 timeout)
+{
+	return detail::check(SusiWDSetConfig(delay, timeout));
+}
+
+inline result<void> wd_trigger()
+{
+	return detail::check(SusiWDTrigger());
+}
+
+inline result<void> wd_disable()
+{
+	return detail::check(SusiWDDisable());
+}
+
+/* SMBus */
+
+inline result<u8> smbus_read(u8 address, u8 reg)
+{
+	u8 value = 0;
+	s8 ret = SusiSMBusReadByte(address, reg, &value);
+
+	return detail::check(ret, value);
+}
+
+inline result<void> smbus_write(u8 address, u8 reg, u8 value)
+{
+	return detail::check(SusiSMBusWriteByte(address, reg, value));
+}
+
+inline result<void> usb_hub(bool enable)
+{
+	return detail::check(SusiUSBHubCtrl(enable));
+}
+
+} /* namespace susi */
+
+#endif /* __SUSI_HPP__ */
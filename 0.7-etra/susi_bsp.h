@@ -0,0 +1,70 @@
+/* SUSI Library - Kernel Helper Interface
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ * ioctl ABI of the /dev/bsp kernel helper for EC mailbox and port I/O.
+ * The helper runs a whole sequence of EC commands per call, waiting on
+ * the mailbox status in the kernel, so the library needs neither iopl
+ * nor userspace polling.
+ *
+ * The ABI belongs to the helper driver: this is a copy of its header,
+ * and the driver's copy wins when they differ. Because another driver
+ * may sit behind /dev/bsp and give these numbers other meanings, the
+ * library issues none of them unless SusiBSPEnable(1) was called;
+ * otherwise, or when BSP_IOC_VERSION fails, port I/O is done from
+ * userspace.
+ */
+
+#ifndef __SUSI_BSP_H__
+#define __SUSI_BSP_H__
+
+#include "susi.h"
+#include <sys/ioctl.h>
+
+#define BSP_ABI_VERSION		1
+
+#define BSP_IOC_MAGIC		'B'
+
+/* EC mailbox */
+#define BSP_EC_OPS_MAX		8
+
+#define BSP_EC_DATA		0x01	/* Write data after the command	*/
+#define BSP_EC_READ		0x02	/* Read one byte back		*/
+
+struct bsp_ec_op {
+	u8 cmd;
+	u8 flags;
+	u8 data;			/* In, with BSP_EC_DATA		*/
+	u8 in;				/* Out, with BSP_EC_READ	*/
+};
+
+/* Runs ops in order under the helper's EC lock, stops at the first
+ * failure; done is set to the number of ops completed */
+struct bsp_ec_xfer {
+	u32 count;
+	u32 timeout;			/* us, 0 = helper default	*/
+	u32 done;
+	u32 reserved;
+	struct bsp_ec_op ops [BSP_EC_OPS_MAX];
+};
+
+/* Port I/O */
+#define BSP_PIO_MAX		32
+
+#define BSP_PIO_WRITE		0x01
+
+/* count accesses of width 1, 2 or 4 bytes to port [i] */
+struct bsp_pio {
+	u16 count;
+	u8 width;
+	u8 flags;
+	u16 port [BSP_PIO_MAX];
+	u32 value [BSP_PIO_MAX];
+};
+
+#define BSP_IOC_VERSION		_IOR(BSP_IOC_MAGIC, 0x40, u32)
+#define BSP_IOC_EC_XFER		_IOWR(BSP_IOC_MAGIC, 0x41, struct bsp_ec_xfer)
+#define BSP_IOC_PIO		_IOWR(BSP_IOC_MAGIC, 0x42, struct bsp_pio)
+
+#endif /* __SUSI_BSP_H__ */
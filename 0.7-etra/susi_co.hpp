@@ -0,0 +1,287 @@
+/* SUSI Library - C++20 Coroutine Binding
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ * Awaitable forms of the susi.hpp calls. The call runs on a library
+ * worker thread while the coroutine is suspended. The coroutine is
+ * resumed through the caller's executor. A stop_token cancels the
+ * wait: the coroutine resumes with -ECANCELED at once. A transaction
+ * already on the bus still completes, and its result is dropped.
+ *
+ * WITHOUT AN EXECUTOR the coroutine resumes on whichever thread
+ * completes the call: the shared worker thread, or the thread that
+ * requested the stop. Everything the coroutine does up to its next
+ * co_await then runs there and holds up every other queued hardware
+ * call in the process, and it races with the caller's own thread.
+ * Pass an executor that posts back to the caller's event loop unless
+ * the coroutine body is trivial and thread-safe.
+ */
+
+#ifndef __SUSI_CO_HPP__
+#define __SUSI_CO_HPP__
+
+#include "susi.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+
+namespace susi::co {
+
+/* Schedules a coroutine resumption, e.g. by posting it to a reactor */
+using executor = std::function<void(std::coroutine_handle<>)>;
+
+/* Runs hardware calls in order, one at a time */
+class worker {
+public:
+	static worker &shared()
+	{
+		static worker w;
+		return w;
+	}
+
+	void submit(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			jobs_.push_back(std::move(job));
+		}
+		cv_.notify_one();
+	}
+
+	~worker()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			stop_ = true;
+		}
+		cv_.notify_one();
+		thr_.join();
+	}
+
+private:
+	worker() : thr_([this] { run(); }) {}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mtx_);
+
+		for (;;) {
+			cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+
+			if (jobs_.empty())
+				return;
+
+			auto job = std::move(jobs_.front());
+			jobs_.pop_front();
+
+			lock.unlock();
+			job();
+			lock.lock();
+		}
+	}
+
+	std::mutex mtx_;
+	std::condition_variable cv_;
+	std::deque<std::function<void()>> jobs_;
+	bool stop_ = false;
+	std::thread thr_;
+};
+
+namespace detail {
+
+/* Shared by the awaiter, the queued job and the stop callback */
+template <typename T>
+struct op_state {
+	std::function<result<T>()> fn;
+	executor ex;
+	std::coroutine_handle<> handle;
+	std::atomic<bool> armed { false };	/* Stop callback may finish */
+	std::atomic<bool> done { false };
+	result<T> res = result<T>::failure(-ECANCELED);
+
+	/* First completion wins; resume through the executor */
+	void finish(result<T> r)
+	{
+		if (done.exchange(true))
+			return;
+
+		res = r;
+
+		if (ex)
+			ex(handle);
+		else
+			handle.resume();
+	}
+};
+
+} /* namespace detail */
+
+/* Awaitable hardware call, co_await yields result<T>; an empty
+ * executor resumes on the worker thread, see above */
+template <typename T>
+class op {
+public:
+	op(std::function<result<T>()> fn, executor ex = {},
+	   std::stop_token st = {})
+		: st_(std::move(st)),
+		  state_(std::make_shared<detail::op_state<T>>())
+	{
+		state_->fn = std::move(fn);
+		state_->ex = std::move(ex);
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		/* The coroutine may resume, destroying this awaiter, as soon
+		 * as the job is queued; only locals are used after that */
+		auto s = state_;
+		auto st = st_;
+
+		/* Cancelled before starting: do not suspend */
+		if (st.stop_requested())
+			return false;
+
+		s->handle = h;
+		cancel_.emplace(st, canceller { s.get() });
+		s->armed.store(true);
+
+		worker::shared().submit([s] {
+			if (!s->done.load())
+				s->finish(s->fn());
+		});
+
+		/* Stop requested before the callback was armed */
+		if (st.stop_requested())
+			s->finish(result<T>::failure(-ECANCELED));
+
+		return true;
+	}
+
+	result<T> await_resume()
+	{
+		cancel_.reset();
+		return state_->res;
+	}
+
+private:
+	struct canceller {
+		detail::op_state<T> *s;
+		void operator()() const
+		{
+			if (s->armed.load())
+				s->finish(result<T>::failure(-ECANCELED));
+		}
+	};
+
+	std::stop_token st_;
+	std::shared_ptr<detail::op_state<T>> state_;
+	std::optional<std::stop_callback<canceller>> cancel_;
+};
+
+namespace detail {
+
+template <typename R>
+struct result_value;
+
+template <typename T>
+struct result_value<result<T>> {
+	using type = T;
+};
+
+} /* namespace detail */
+
+/* Any callable returning result<T> as an awaitable */
+template <typename F>
+inline auto async(F fn, executor ex = {}, std::stop_token st = {})
+{
+	using T = typename detail::result_value<decltype(fn())>::type;
+
+	return op<T>(std::move(fn), std::move(ex), std::move(st));
+}
+
+/* GPIO */
+
+inline op<level> read(pin p, executor ex = {}, std::stop_token st = {})
+{
+	return op<level>([p] { return susi::read(p); }, std::move(ex), std::move(st));
+}
+
+inline op<void> write(pin p, level l, executor ex = {}, std::stop_token st = {})
+{
+	return op<void>([p, l] { return susi::write(p, l); }, std::move(ex), std::move(st));
+}
+
+/* Hardware monitor */
+
+inline op<flt> read(temp t, executor ex = {}, std::stop_token st = {})
+{
+	return op<flt>([t] { return susi::read(t); }, std::move(ex), std::move(st));
+}
+
+inline op<flt> read(volt v, executor ex = {}, std::stop_token st = {})
+{
+	return op<flt>([v] { return susi::read(v); }, std::move(ex), std::move(st));
+}
+
+inline op<u16> read(fan f, executor ex = {}, std::stop_token st = {})
+{
+	return op<u16>([f] { return susi::read(f); }, std::move(ex), std::move(st));
+}
+
+inline op<void> set_duty(fan f, u8 duty, executor ex = {},
+			 std::stop_token st = {})
+{
+	return op<void>([f, duty] { return susi::set_duty(f, duty); },
+			std::move(ex), std::move(st));
+}
+
+/* Watchdog */
+
+inline op<void> wd_start(u32 delay, u32 timeout, executor ex = {},
+			 std::stop_token st = {})
+{
+	return op<void>([delay, timeout] { return susi::wd_start(delay, timeout); },
+			std::move(ex), std::move(st));
+}
+
+inline op<void> wd_trigger(executor ex = {}, std::stop_token st = {})
+{
+	return op<void>([] { return susi::wd_trigger(); }, std::move(ex), std::move(st));
+}
+
+inline op<void> wd_disable(executor ex = {}, std::stop_token st = {})
+{
+	return op<void>([] { return susi::wd_disable(); }, std::move(ex), std::move(st));
+}
+
+/* SMBus */
+
+inline op<u8> smbus_read(u8 address, u8 reg, executor ex = {},
+			 std::stop_token st = {})
+{
+	return op<u8>([address, reg] { return susi::smbus_read(address, reg); },
+		      std::move(ex), std::move(st));
+}
+
+inline op<void> smbus_write(u8 address, u8 reg, u8 value, executor ex = {},
+			    std::stop_token st = {})
+{
+	return op<void>([address, reg, value] {
+				return susi::smbus_write(address, reg, value);
+			}, std::move(ex), std::move(st));
+}
+
+} /* namespace susi::co */
+
+#endif /* __SUSI_CO_HPP__ */
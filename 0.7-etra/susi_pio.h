@@ -0,0 +1,95 @@
+/* SUSI Library - Inline Port I/O
+ * (C) Advantech 2010
+ *
+ * See the SUSI Linux API document for API details.
+ *
+ * Optional header-only port I/O for tight loops. SusiPortIOFastInit()
+ * checks that port I/O is available to the calling thread (I/O
+ * privileges are per thread) and fills in a token; the
+ * inline calls below take that token and compile down to the bare
+ * in/out instruction in the caller, with no library call or checks.
+ * The SusiPortIOGet/Set calls in susi.h remain for existing users.
+ */
+
+#ifndef __SUSI_PIO_H__
+#define __SUSI_PIO_H__
+
+#include "susi.h"
+#include <sys/io.h>
+
+#define SUSI_PIO_MAGIC		0x5355494F	/* "SUIO" */
+
+/* Proof that port I/O was checked, see SusiPortIOFastInit() */
+typedef struct {
+	u32 magic;
+} SusiPIOToken;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+s8 SusiPortIOFastInit(SusiPIOToken *token);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* Read byte from port */
+static inline u8 SusiPIOInByte(const SusiPIOToken *token, u16 port)
+{
+	(void)token;
+	return inb(port);
+}
+
+/* Read short from port */
+static inline u16 SusiPIOInWord(const SusiPIOToken *token, u16 port)
+{
+	(void)token;
+	return inw(port);
+}
+
+/* Read long from port */
+static inline u32 SusiPIOInLong(const SusiPIOToken *token, u16 port)
+{
+	(void)token;
+	return inl(port);
+}
+
+/* Out byte to port */
+static inline void SusiPIOOutByte(const SusiPIOToken *token, u16 port, u8 data)
+{
+	(void)token;
+	outb(data, port);
+}
+
+/* Out short to port */
+static inline void SusiPIOOutWord(const SusiPIOToken *token, u16 port, u16 data)
+{
+	(void)token;
+	outw(data, port);
+}
+
+/* Out long to port */
+static inline void SusiPIOOutLong(const SusiPIOToken *token, u16 port, u32 data)
+{
+	(void)token;
+	outl(data, port);
+}
+
+/* Read byte buffer from port */
+static inline void SusiPIOInBufByte(const SusiPIOToken *token, u16 port,
+				    u8 *buf, u32 count)
+{
+	(void)token;
+	insb(port, buf, count);
+}
+
+/* Out byte buffer to port */
+static inline void SusiPIOOutBufByte(const SusiPIOToken *token, u16 port,
+				     const u8 *buf, u32 count)
+{
+	(void)token;
+	outsb(port, buf, count);
+}
+
+#endif /* __SUSI_PIO_H__ */
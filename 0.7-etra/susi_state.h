@@ -0,0 +1,60 @@
+/* SUSI Library - Broker State Page
+ * (C) Advantech 2010
+ *
+ * Layout of the shared state page published by susid and the
+ * command messages it accepts. Internal to the library and susid.
+ */
+
+#ifndef __SUSI_STATE_H__
+#define __SUSI_STATE_H__
+
+#include "susi.h"
+
+#define STATE_SHM		"/susi-state"
+#define STATE_SOCK		"/var/run/susid.sock"
+#define STATE_MAGIC		0x53555354	/* "SUST" */
+#define STATE_VERSION		1
+
+/* Valid field flags */
+#define STATE_TCPU		(1 << 0)
+#define STATE_TSYS		(1 << 1)
+#define STATE_VCORE		(1 << 2)
+#define STATE_V33		(1 << 3)
+#define STATE_V50		(1 << 4)
+#define STATE_IO		(1 << 5)
+
+/* Broker commands */
+#define STATE_CMD_IO_WRITE	1	/* arg0: targetmask, arg1: statusmask */
+#define STATE_CMD_IO_DIR	2	/* arg0: pin, arg1: dir */
+#define STATE_CMD_WD_CONFIG	3	/* arg0: delay, arg1: timeout */
+#define STATE_CMD_WD_TRIGGER	4
+#define STATE_CMD_WD_DISABLE	5
+#define STATE_CMD_USB_HUB	6	/* arg0: enable */
+
+/*
+ * Shared state, written by susid only. seq is odd while an update
+ * is in progress; readers retry until they see the same even value
+ * before and after copying.
+ */
+struct susi_state {
+	u32 magic;
+	u32 version;
+	u32 seq;
+	u32 valid;
+	u64 stamp;		/* CLOCK_MONOTONIC ns of last refresh */
+	flt temp [2];		/* TCPU, TSYS */
+	flt volt [3];		/* VCORE, V33, V50 */
+	u32 io_status;		/* User GPIO 0-7 levels */
+};
+
+/* Command message, answered with a struct susi_state_rsp */
+struct susi_state_cmd {
+	u32 cmd;
+	u32 arg [2];
+};
+
+struct susi_state_rsp {
+	s32 err;		/* 0 or -errno */
+};
+
+#endif /* __SUSI_STATE_H__ */
@@ -0,0 +1,488 @@
+/* SUSI Contention Benchmark
+ * (C) Advantech 2010
+ *
+ * Runs a mix of SUSI calls from a growing number of threads, spread
+ * over one or more processes, and reports aggregate throughput, per
+ * call latency percentiles and the time spent waiting for the EC and
+ * SMBus locks at each step.
+ *
+ * Usage: susibench [-b direct|broker|cached] [-m mix] [-t threads]
+ *                  [-P procs] [-d seconds]
+ *
+ *   -m  weighted call mix, e.g. gpio=4,temp=2,wd=1 (default gpio=1,temp=1)
+ *   -t  thread counts to step through, e.g. 1,2,4,8 (default 1,2,4,8,16)
+ *   -P  processes per step, each running the step's thread count
+ */
+
+#include "susi.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define OP_GPIO			0
+#define OP_TEMP			1
+#define OP_WD			2
+#define OP_MAX			3
+
+#define BACKEND_DIRECT		0
+#define BACKEND_BROKER		1
+#define BACKEND_CACHED		2
+
+#define MAX_STEPS		16
+#define MAX_SCHED		64	/* Sum of mix weights */
+#define NBUCKET			256
+#define DEF_DURATION		5	/* s */
+
+/* Latency histogram, four buckets per power of two (~25 %) */
+struct hist {
+	u64 count [NBUCKET];
+	u64 ops, errs, max;
+};
+
+/* One process' results, shared with the parent */
+struct proc_result {
+	struct hist op [OP_MAX];
+	u64 elapsed;			/* ns */
+	u64 stat [SUSI_STAT_MAX];	/* Deltas over the run */
+};
+
+/* Globals */
+
+static const char *op_names [OP_MAX] = { "gpio", "temp", "wd" };
+static const char *backend_names [] = { "direct", "broker", "cached" };
+
+static int backend = BACKEND_DIRECT;
+static u32 weight [OP_MAX] = { 1, 1, 0 };
+static u32 steps [MAX_STEPS] = { 1, 2, 4, 8, 16 };
+static u32 nsteps = 5;
+static u32 procs = 1;
+static u32 duration = DEF_DURATION;
+
+static u8 sched [MAX_SCHED];
+static u32 nsched;
+
+/* Per process run state */
+static struct proc_result *self;
+static pthread_mutex_t merge_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t start;
+static u64 end_ns;
+
+/* -------------------------- Histogram ------------------------------------ */
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static u32 bucket(u64 ns)
+{
+	u32 l;
+
+	if (ns < 4)
+		return ns;
+
+	l = 63 - __builtin_clzll(ns);
+	return (l - 1) * 4 + ((ns >> (l - 2)) & 3);
+}
+
+/* Upper bound of a bucket, ns */
+static u64 bucket_max(u32 b)
+{
+	u32 l = b / 4 + 1;
+
+	if (b < 4)
+		return b;
+
+	return ((u64)(4 + (b & 3) + 1) << (l - 2)) - 1;
+}
+
+static void hist_add(struct hist *h, u64 ns, int ok)
+{
+	h->count [bucket(ns)]++;
+	h->ops++;
+	if (!ok)
+		h->errs++;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+static void hist_merge(struct hist *to, const struct hist *from)
+{
+	u32 i;
+
+	for (i = 0; i < NBUCKET; i++)
+		to->count [i] += from->count [i];
+
+	to->ops += from->ops;
+	to->errs += from->errs;
+	if (from->max > to->max)
+		to->max = from->max;
+}
+
+/* Latency at quantile q (0-1), ns */
+static u64 hist_quantile(const struct hist *h, double q)
+{
+	u64 rank = (u64)(q * h->ops), seen = 0;
+	u32 i;
+
+	for (i = 0; i < NBUCKET; i++)
+		if ((seen += h->count [i]) > rank)
+			return bucket_max(i) < h->max ? bucket_max(i) : h->max;
+
+	return h->max;
+}
+
+/* -------------------------- Workers -------------------------------------- */
+
+/* One call on the selected backend */
+static int run_op(int op)
+{
+	u32 status = 0, armed, timeout;
+	u64 stamp;
+	flt value;
+	u8 level;
+
+	switch (backend) {
+		case BACKEND_DIRECT:
+			switch (op) {
+				case OP_GPIO:
+					return SusiIOReadEx(0, &level) == 1;
+				case OP_TEMP:
+					return SusiHWMGetTemperature(TCPU, &value, NULL) == 1;
+				case OP_WD:
+					return SusiWDTrigger() == 1;
+			}
+			break;
+		case BACKEND_BROKER:
+			switch (op) {
+				case OP_GPIO:
+					return SusiStateReadIO(1, &status) == 1;
+				case OP_TEMP:
+					return SusiStateGetTemperature(TCPU, &value) == 1;
+				case OP_WD:
+					return SusiBrokerWDTrigger() == 1;
+			}
+			break;
+		case BACKEND_CACHED:
+			switch (op) {
+				case OP_GPIO:
+					return SusiIOGetCached(&armed, &status) == 1;
+				case OP_TEMP:
+					return SusiHWMGetCached(SUSI_SENSOR_TCPU, &value, &stamp) == 1;
+				case OP_WD:
+					return SusiWDGetCached(&armed, &timeout, &stamp) == 1;
+			}
+			break;
+	}
+
+	return 0;
+}
+
+static void *worker(void *arg)
+{
+	struct hist h [OP_MAX];
+	u64 t0, t1;
+	u32 i = (long)arg;
+	int op, ok;
+
+	memset(h, 0, sizeof(h));
+	pthread_barrier_wait(&start);
+
+	/* Threads start at different points of the mix */
+	for (t1 = now_ns(); t1 < end_ns; i++) {
+		op = sched [i % nsched];
+		t0 = t1;
+		ok = run_op(op);
+		t1 = now_ns();
+		hist_add(&h [op], t1 - t0, ok);
+	}
+
+	pthread_mutex_lock(&merge_lock);
+	for (op = 0; op < OP_MAX; op++)
+		hist_merge(&self->op [op], &h [op]);
+	pthread_mutex_unlock(&merge_lock);
+
+	return NULL;
+}
+
+/* Child process body, returns the exit status */
+static int run_proc(u32 threads)
+{
+	pthread_t tid [threads];
+	u64 stat0 [SUSI_STAT_MAX], t0;
+	u32 i;
+
+	if (backend == BACKEND_BROKER ? !SusiStateAttach() : !SusiInit()) {
+		fprintf(stderr, "susibench: init: %s\n",
+			strerror(-SusiGetLastError()));
+		return 1;
+	}
+
+	/* Prime the cache so cached reads have something to return */
+	if (backend == BACKEND_CACHED)
+		for (i = 0; i < OP_MAX; i++) {
+			backend = BACKEND_DIRECT;
+			run_op(i);
+			backend = BACKEND_CACHED;
+		}
+
+	for (i = 0; i < SUSI_STAT_MAX; i++)
+		SusiGetStat(i, &stat0 [i]);
+
+	pthread_barrier_init(&start, NULL, threads + 1);
+
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&tid [i], NULL, worker,
+				   (void *)(long)(i * nsched / threads))) {
+			perror("susibench: pthread_create");
+			_exit(1);
+		}
+
+	t0 = now_ns();
+	end_ns = t0 + (u64)duration * 1000000000ULL;
+	pthread_barrier_wait(&start);
+
+	for (i = 0; i < threads; i++)
+		pthread_join(tid [i], NULL);
+
+	self->elapsed = now_ns() - t0;
+
+	for (i = 0; i < SUSI_STAT_MAX; i++) {
+		SusiGetStat(i, &self->stat [i]);
+		self->stat [i] -= stat0 [i];
+	}
+
+	if (backend == BACKEND_BROKER)
+		SusiStateDetach();
+	else
+		SusiUnInit();
+
+	return 0;
+}
+
+/* -------------------------- Reporting ------------------------------------ */
+
+static void report(u32 threads, const struct proc_result *res)
+{
+	struct hist all [OP_MAX];
+	u64 elapsed = 0, ops = 0, stat [SUSI_STAT_MAX];
+	u32 p, i;
+
+	memset(all, 0, sizeof(all));
+	memset(stat, 0, sizeof(stat));
+
+	for (p = 0; p < procs; p++) {
+		for (i = 0; i < OP_MAX; i++)
+			hist_merge(&all [i], &res [p].op [i]);
+		for (i = 0; i < SUSI_STAT_MAX; i++)
+			stat [i] += res [p].stat [i];
+		if (res [p].elapsed > elapsed)
+			elapsed = res [p].elapsed;
+	}
+
+	for (i = 0; i < OP_MAX; i++)
+		ops += all [i].ops;
+
+	if (!elapsed)
+		elapsed = 1;
+
+	printf("%3u x %-3u %12.0f ops/s   lock waits %llu, ec %.3f ms, "
+	       "smbus %.3f ms\n", procs, threads,
+	       ops * 1e9 / elapsed,
+	       (unsigned long long)stat [SUSI_STAT_LOCK_WAITS],
+	       stat [SUSI_STAT_LOCK_EC_NS] / 1e6,
+	       stat [SUSI_STAT_LOCK_SMBUS_NS] / 1e6);
+
+	for (i = 0; i < OP_MAX; i++) {
+		if (!all [i].ops)
+			continue;
+
+		printf("          %-5s %10llu calls %8llu errs   us p50 %9.1f "
+		       "p99 %9.1f p99.9 %9.1f max %9.1f\n", op_names [i],
+		       (unsigned long long)all [i].ops,
+		       (unsigned long long)all [i].errs,
+		       hist_quantile(&all [i], 0.5) / 1e3,
+		       hist_quantile(&all [i], 0.99) / 1e3,
+		       hist_quantile(&all [i], 0.999) / 1e3,
+		       all [i].max / 1e3);
+	}
+}
+
+/* Run one step across procs processes */
+static int run_step(u32 threads)
+{
+	struct proc_result *res;
+	size_t size = sizeof(*res) * procs;
+	int status, ret = 0;
+	pid_t pid;
+	u32 p;
+
+	res = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED) {
+		perror("susibench: mmap");
+		return -1;
+	}
+
+	memset(res, 0, size);
+
+	for (p = 0; p < procs; p++) {
+		if ((pid = fork()) < 0) {
+			perror("susibench: fork");
+			ret = -1;
+			break;
+		}
+
+		if (!pid) {
+			self = &res [p];
+			_exit(run_proc(threads));
+		}
+	}
+
+	while (wait(&status) > 0)
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			ret = -1;
+
+	if (!ret)
+		report(threads, res);
+
+	munmap(res, size);
+	return ret;
+}
+
+/* -------------------------- Options -------------------------------------- */
+
+/* "gpio=4,temp=2,wd=1" */
+static int parse_mix(char *arg)
+{
+	char *tok, *val;
+	u32 i, n;
+
+	memset(weight, 0, sizeof(weight));
+
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		n = 1;
+		if ((val = strchr(tok, '='))) {
+			*val++ = '\0';
+			n = atoi(val);
+		}
+
+		for (i = 0; i < OP_MAX; i++)
+			if (!strcmp(tok, op_names [i]))
+				break;
+
+		if (i == OP_MAX)
+			return -1;
+
+		weight [i] = n;
+	}
+
+	return 0;
+}
+
+/* "1,2,4,8" */
+static int parse_steps(char *arg)
+{
+	char *tok;
+
+	nsteps = 0;
+
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (nsteps == MAX_STEPS || !(steps [nsteps] = atoi(tok)))
+			return -1;
+		nsteps++;
+	}
+
+	return nsteps ? 0 : -1;
+}
+
+/* Interleave the mix so each op is spread through the schedule */
+static int build_sched(void)
+{
+	u32 left [OP_MAX], i;
+
+	memcpy(left, weight, sizeof(left));
+
+	for (nsched = 0; nsched < MAX_SCHED; ) {
+		u32 added = 0;
+
+		for (i = 0; i < OP_MAX && nsched < MAX_SCHED; i++)
+			if (left [i]) {
+				left [i]--;
+				sched [nsched++] = i;
+				added++;
+			}
+
+		if (!added)
+			break;
+	}
+
+	for (i = 0; i < OP_MAX; i++)
+		if (left [i])
+			return -1;
+
+	return nsched ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	u32 i;
+
+	while ((opt = getopt(argc, argv, "b:m:t:P:d:")) != -1) {
+		switch (opt) {
+			case 'b':
+				for (backend = 0; backend <= BACKEND_CACHED; backend++)
+					if (!strcmp(optarg, backend_names [backend]))
+						break;
+				if (backend > BACKEND_CACHED)
+					goto usage;
+				break;
+			case 'm':
+				if (parse_mix(optarg) < 0)
+					goto usage;
+				break;
+			case 't':
+				if (parse_steps(optarg) < 0)
+					goto usage;
+				break;
+			case 'P':
+				if (!(procs = atoi(optarg)))
+					goto usage;
+				break;
+			case 'd':
+				if (!(duration = atoi(optarg)))
+					goto usage;
+				break;
+			default:
+				goto usage;
+		}
+	}
+
+	if (build_sched() < 0)
+		goto usage;
+
+	printf("backend %s, %u s per step, mix", backend_names [backend],
+	       duration);
+	for (i = 0; i < OP_MAX; i++)
+		if (weight [i])
+			printf(" %s=%u", op_names [i], weight [i]);
+	printf("\n\nprocs x threads\n");
+
+	for (i = 0; i < nsteps; i++)
+		if (run_step(steps [i]) < 0)
+			return 1;
+
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-b direct|broker|cached] [-m gpio=N,temp=N,wd=N] "
+		"[-t threads,...] [-P procs] [-d seconds]\n", argv [0]);
+	return 1;
+}
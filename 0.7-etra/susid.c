@@ -0,0 +1,430 @@
+/* SUSI Broker Daemon
+ * (C) Advantech 2010
+ *
+ * Owns the hardware on behalf of other processes. A poller thread
+ * refreshes sensors and GPIO inputs into the shared state page, and
+ * the main loop runs write commands received on the Unix socket.
+ *
+ * The command socket is open to root and the socket group only, "susi"
+ * unless -g names another group or gid.
+ *
+ * -b routes EC and port I/O through the /dev/bsp helper's ioctls.
+ *
+ * Usage: susid [-f] [-b] [-p period_ms] [-m metrics_port] [-g group]
+ */
+
+#include "susi.h"
+#include "susi_state.h"
+#include <fcntl.h>
+#include <grp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define MAX_CLIENTS		32
+#define DEF_PERIOD		1000	/* ms */
+#define DEF_GROUP		"susi"
+#define SOCK_MODE		0660
+#define WD_DELAY_MAX		1000	/* ms a WD_CONFIG may hold the broker */
+
+/* Globals */
+
+static struct susi_state *state = NULL;
+static volatile sig_atomic_t running = 1;
+static u32 period = DEF_PERIOD;
+static u16 metrics_port = 0;
+static const char *sock_group = DEF_GROUP;
+
+/* -------------------------- State Page ----------------------------------- */
+
+/* Map and initialize the state page; always a fresh object of our
+ * own, never one another user created under the name first */
+static int state_create(void)
+{
+	struct stat st;
+	int fd;
+
+	if (shm_unlink(STATE_SHM) < 0 && errno != ENOENT)
+		return -errno;
+
+	if ((fd = shm_open(STATE_SHM, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0 || st.st_uid != geteuid()) {
+		close(fd);
+		return -EPERM;
+	}
+
+	fchmod(fd, 0644);
+
+	if (ftruncate(fd, sizeof(*state)) < 0) {
+		close(fd);
+		return -errno;
+	}
+
+	state = mmap(NULL, sizeof(*state), PROT_READ | PROT_WRITE, 
+		     MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (state == MAP_FAILED)
+		return -errno;
+
+	memset(state, 0, sizeof(*state));
+	state->version = STATE_VERSION;
+	__atomic_store_n(&state->magic, STATE_MAGIC, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* Publish a new snapshot, seqlock writer side */
+static void state_publish(const struct susi_state *snap)
+{
+	u32 seq = state->seq;
+
+	__atomic_store_n(&state->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	state->valid = snap->valid;
+	state->stamp = snap->stamp;
+	memcpy(state->temp, snap->temp, sizeof(state->temp));
+	memcpy(state->volt, snap->volt, sizeof(state->volt));
+	state->io_status = snap->io_status;
+
+	__atomic_store_n(&state->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Flag every value stale, seqlock writer side */
+static void state_invalidate(void)
+{
+	u32 seq = state->seq;
+
+	__atomic_store_n(&state->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	state->valid = 0;
+
+	__atomic_store_n(&state->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* -------------------------- Poller --------------------------------------- */
+
+/* Read all sensors and inputs once */
+static void poll_hardware(struct susi_state *snap)
+{
+	static const u16 volts [3] = { VCORE, V33, V50 };
+	struct timespec ts;
+	int i;
+
+	snap->valid = 0;
+
+	if (SusiHWMGetTemperature(TCPU, &snap->temp [0], NULL))
+		snap->valid |= STATE_TCPU;
+	if (SusiHWMGetTemperature(TSYS, &snap->temp [1], NULL))
+		snap->valid |= STATE_TSYS;
+
+	for (i = 0; i < 3; i++)
+		if (SusiHWMGetVoltage(volts [i], &snap->volt [i], NULL))
+			snap->valid |= STATE_VCORE << i;
+
+	if (SusiIOReadMultiEx(0xFF, &snap->io_status))
+		snap->valid |= STATE_IO;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	snap->stamp = (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Poller thread */
+static void *poller(void *arg)
+{
+	struct susi_state snap;
+
+	memset(&snap, 0, sizeof(snap));
+
+	while (running) {
+		poll_hardware(&snap);
+		state_publish(&snap);
+		usleep(period * 1000);
+	}
+
+	return NULL;
+}
+
+/* OpenMetrics thread, serves the poller's cached values */
+static void *metrics(void *arg)
+{
+	if (!SusiMetricsServe(NULL, metrics_port))
+		fprintf(stderr, "susid: metrics: %s\n", 
+			strerror(-SusiGetLastError()));
+
+	return NULL;
+}
+
+/* -------------------------- Commands ------------------------------------- */
+
+/* Run one command against the hardware */
+static s32 run_cmd(const struct susi_state_cmd *req)
+{
+	s32 ret;
+	s8 ok;
+
+	switch (req->cmd) {
+		case STATE_CMD_IO_WRITE:
+			ok = SusiIOWriteMultiEx(req->arg [0], req->arg [1]);
+			break;
+		case STATE_CMD_IO_DIR:
+			ok = SusiIOSetDirection(req->arg [0], req->arg [1], NULL);
+			break;
+		case STATE_CMD_WD_CONFIG:
+			/* The delay is slept in this loop, stalling every client */
+			if (req->arg [0] > WD_DELAY_MAX)
+				return -EINVAL;
+
+			ok = SusiWDSetConfig(req->arg [0], req->arg [1]);
+			break;
+		case STATE_CMD_WD_TRIGGER:
+			ok = SusiWDTrigger();
+			break;
+		case STATE_CMD_WD_DISABLE:
+			ok = SusiWDDisable();
+			break;
+		case STATE_CMD_USB_HUB:
+			ok = SusiUSBHubCtrl(req->arg [0]);
+			break;
+		default:
+			return -EINVAL;
+	}
+
+	if (ok)
+		return 0;
+
+	/* The error of this thread's call, not the poller's */
+	ret = SusiGetLastError();
+
+	return ret < 0 ? ret : -EIO;
+}
+
+/* Socket group from a name or a numeric gid */
+static int sock_gid(gid_t *gid)
+{
+	struct group *gr;
+	char *end;
+	long n;
+
+	if ((gr = getgrnam(sock_group))) {
+		*gid = gr->gr_gid;
+		return 0;
+	}
+
+	n = strtol(sock_group, &end, 10);
+
+	if (!*sock_group || *end || n < 0)
+		return -ENOENT;
+
+	*gid = n;
+	return 0;
+}
+
+/* Open the command socket */
+static int sock_create(void)
+{
+	struct sockaddr_un addr;
+	gid_t gid;
+	int fd;
+
+	if ((fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, STATE_SOCK, sizeof(addr.sun_path) - 1);
+
+	unlink(STATE_SOCK);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, MAX_CLIENTS) < 0) {
+		close(fd);
+		return -errno;
+	}
+
+	/* Only root and the socket group may drive the hardware */
+	if (sock_gid(&gid) < 0)
+		fprintf(stderr, "susid: group %s unknown, socket is root only\n",
+			sock_group);
+	else if (chown(STATE_SOCK, -1, gid) < 0)
+		perror("susid: chown socket");
+
+	if (chmod(STATE_SOCK, SOCK_MODE) < 0) {
+		close(fd);
+		unlink(STATE_SOCK);
+		return -errno;
+	}
+
+	return fd;
+}
+
+/* Serve commands until told to stop */
+static void serve(int lfd)
+{
+	struct pollfd fds [MAX_CLIENTS + 1];
+	struct susi_state_cmd req;
+	struct susi_state_rsp rsp;
+	int nfds = 1, i, fd;
+
+	fds [0].fd = lfd;
+	fds [0].events = POLLIN;
+
+	while (running) {
+		if (poll(fds, nfds, -1) < 0)
+			continue;
+
+		/* New client */
+		if (fds [0].revents & POLLIN) {
+			fd = accept(lfd, NULL, NULL);
+
+			if (fd >= 0 && nfds <= MAX_CLIENTS) {
+				fds [nfds].fd = fd;
+				fds [nfds].events = POLLIN;
+				fds [nfds].revents = 0;
+				nfds++;
+			} else if (fd >= 0)
+				close(fd);
+		}
+
+		for (i = 1; i < nfds; i++) {
+			if (!fds [i].revents)
+				continue;
+
+			if (recv(fds [i].fd, &req, sizeof(req), 0) != sizeof(req)) {
+				/* Client gone */
+				close(fds [i].fd);
+				fds [i--] = fds [--nfds];
+				continue;
+			}
+
+			rsp.err = run_cmd(&req);
+
+			/* A client not reading its replies is dropped rather
+			 * than stalling the loop */
+			if (send(fds [i].fd, &rsp, sizeof(rsp),
+				 MSG_NOSIGNAL | MSG_DONTWAIT) != sizeof(rsp)) {
+				close(fds [i].fd);
+				fds [i--] = fds [--nfds];
+			}
+		}
+	}
+}
+
+/* -------------------------- Main ----------------------------------------- */
+
+static void on_signal(int sig)
+{
+	running = 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct sigaction sa;
+	sigset_t sigs, old;
+	pthread_t tid, mtid;
+	int foreground = 0, bsp = 0, opt, lfd, ret;
+
+	while ((opt = getopt(argc, argv, "fbp:m:g:")) != -1) {
+		switch (opt) {
+			case 'f':
+				foreground = 1;
+				break;
+			case 'b':
+				bsp = 1;
+				break;
+			case 'p':
+				period = atoi(optarg);
+				break;
+			case 'm':
+				metrics_port = atoi(optarg);
+				break;
+			case 'g':
+				sock_group = optarg;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-f] [-b] [-p period_ms] "
+					"[-m metrics_port] [-g group]\n", argv [0]);
+				return 1;
+		}
+	}
+
+	if (!period)
+		period = DEF_PERIOD;
+
+	if (!SusiInit()) {
+		fprintf(stderr, "susid: SusiInit: %s\n", 
+			strerror(-SusiGetLastError()));
+		return 1;
+	}
+
+	if (bsp && !SusiBSPEnable(1)) {
+		fprintf(stderr, "susid: SusiBSPEnable: %s\n", 
+			strerror(-SusiGetLastError()));
+		return 1;
+	}
+
+	if ((ret = state_create()) < 0) {
+		fprintf(stderr, "susid: state page: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	if ((lfd = sock_create()) < 0) {
+		fprintf(stderr, "susid: %s: %s\n", STATE_SOCK, strerror(-lfd));
+		return 1;
+	}
+
+	if (!foreground && daemon(0, 0) < 0) {
+		perror("susid: daemon");
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	/* Signals go to the main thread only, so they interrupt poll() in
+	 * serve() rather than a hardware call in the poller */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &sigs, &old);
+
+	if (pthread_create(&tid, NULL, poller, NULL)) {
+		fprintf(stderr, "susid: cannot start poller\n");
+		return 1;
+	}
+
+	if (metrics_port && pthread_create(&mtid, NULL, metrics, NULL))
+		metrics_port = 0;
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	serve(lfd);
+
+	/* Readers see stale values flagged invalid from here on */
+	pthread_join(tid, NULL);
+
+	if (metrics_port) {
+		SusiMetricsStop();
+		pthread_join(mtid, NULL);
+	}
+	state_invalidate();
+
+	close(lfd);
+	unlink(STATE_SOCK);
+	SusiUnInit();
+
+	return 0;
+}
@@ -7,9 +7,6 @@
 
 #include "susi.h"
 
-#define EC_PMC2_CMD			0x6C
-#define EC_PMC2_DAT			0x68
-
 /* Watchdog cmds */
 #define EC_PMC2_CMD_WDT_START		0xF0
 #define EC_PMC2_CMD_WDT_STOP		0xF1
@@ -18,30 +15,30 @@
 
 /* Globals */
 
-extern int smbus_fd;
-extern int kernel_fd;
-extern int susi_err;
+extern __thread int susi_err;
+
+extern s32 __acquire_pio(void);
+extern s32 __ec_write(u8 cmd);
+extern s32 __ec_write_data(u8 cmd, u8 data);
+extern void __cache_wd(u32 armed, u32 timeout);
+extern void __cache_wd_trigger(void);
 
 /* -------------------------- External API --------------------------------- */
 
 /* Check if available */
 u8 SusiWDAvailable(void)
 {
-	if (smbus_fd >= 0 && kernel_fd >= 0) 
+	if (__acquire_pio() >= 0)
 		return 1;
-	else {
-		susi_err = -EAGAIN;
+	else
 		return -1;
-	}
 }
 
 /* Get settings - Not supported */
 s8 SusiWDGetRange(u32 *min, u32* max, u32* step)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	if (__acquire_pio() < 0)
 		return 0;
-	}
 
 	if (!min || !max || !step) {
 		susi_err = -EINVAL;
@@ -55,29 +52,22 @@ s8 SusiWDGetRange(u32 *min, u32* max, u32* step)
 /* Start WD timer */
 s8 SusiWDSetConfig(u32 delay, u32 timeout)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
-		return 0;
-	}
+	s32 ret;
 
-	if (delay < 0 || timeout < 0) {
-		susi_err = -EINVAL;
+	if (__acquire_pio() < 0)
 		return 0;
-	}
 
 	usleep(delay * 1000);
 
-	SusiPortIOSetByte(EC_PMC2_CMD, EC_PMC2_CMD_WDT_STOP);
-	sleep(1);
-
-	SusiPortIOSetByte(EC_PMC2_CMD, EC_PMC2_CMD_WDT_SET_TIME);
-	sleep(1);
-
-	SusiPortIOSetByte(EC_PMC2_DAT, timeout / 1000);
-	sleep(1);
+	if ((ret = __ec_write(EC_PMC2_CMD_WDT_STOP)) < 0 ||
+	    (ret = __ec_write_data(EC_PMC2_CMD_WDT_SET_TIME,
+				   timeout / 1000)) < 0 ||
+	    (ret = __ec_write(EC_PMC2_CMD_WDT_START)) < 0) {
+		susi_err = ret;
+		return 0;
+	}
 
-	SusiPortIOSetByte(EC_PMC2_CMD, EC_PMC2_CMD_WDT_START);
-	sleep(1);
+	__cache_wd(1, timeout);
 	
 	return 1;
 }
@@ -85,13 +75,17 @@ s8 SusiWDSetConfig(u32 delay, u32 timeout)
 /* Reset timer */
 s8 SusiWDTrigger(void)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	s32 ret;
+
+	if (__acquire_pio() < 0)
+		return 0;
+
+	if ((ret = __ec_write(EC_PMC2_CMD_WDT_TRIGGER)) < 0) {
+		susi_err = ret;
 		return 0;
 	}
 
-	SusiPortIOSetByte(EC_PMC2_CMD, EC_PMC2_CMD_WDT_TRIGGER);
-	sleep(1);
+	__cache_wd_trigger();
 
 	return 1;
 }
@@ -99,13 +93,17 @@ s8 SusiWDTrigger(void)
 /* Disable WD */
 s8 SusiWDDisable(void)
 {
-	if (smbus_fd < 0 || kernel_fd < 0) {
-		susi_err = -EAGAIN;
+	s32 ret;
+
+	if (__acquire_pio() < 0)
+		return 0;
+
+	if ((ret = __ec_write(EC_PMC2_CMD_WDT_STOP)) < 0) {
+		susi_err = ret;
 		return 0;
 	}
 
-	SusiPortIOSetByte(EC_PMC2_CMD, EC_PMC2_CMD_WDT_STOP);
-	sleep(1);
+	__cache_wd(0, 0);
 
 	return 1;
 }